@@ -27,7 +27,6 @@
 #include <Chipset/irqs.h>
 #include <Chipset/timer.h>
 #include <Library/gpio.h>
-#include <Library/DS2746.h>
 #include <Library/hsusb.h>
 
 #include <Device/Gpio.h>
@@ -35,9 +34,25 @@
 
 #include <Protocol/GpioTlmm.h>
 #include <Protocol/HtcLeoMicroP.h>
+#include <Protocol/HtcLeoBatteryGauge.h>
+#include <Protocol/GpioTlmmInterrupt.h>
+#include <Protocol/HardwareInterrupt.h>
 
 #define USB_STATUS        0xef20c
 
+// The modem raises its state change interrupt when it updates USB_STATUS
+#define CHARGER_CABLE_IRQ INT_A9_M2A_5
+
+#define CHARGER_OVER_CHG_DEBOUNCE_US  10000
+
+// Sampling backs off from MIN to MAX while nothing changes
+#define CHARGER_POLL_MIN_MS   250
+#define CHARGER_POLL_MAX_MS   8000
+// Without a cable there's nothing to sample but the cable status
+#define CHARGER_POLL_IDLE_MS  2000
+// The cable status word is checked this often in case no interrupt comes
+#define CHARGER_CABLE_POLL_MS 2000
+
 #define VOLTAGE_3700 0
 #define VOLTAGE_3800 1
 #define VOLTAGE_3900 2
@@ -46,11 +61,21 @@
 #define VOLTAGE_4200 5
 
 EFI_EVENT m_CallbackTimer = NULL;
+EFI_EVENT m_CablePollTimer = NULL;
 EFI_EVENT EfiExitBootServicesEvent      = (EFI_EVENT)NULL;
 
 // Cached copy of the Hardware Gpio protocol instance
 TLMM_GPIO *gGpio = NULL;
 HTCLEO_MICROP_PROTOCOL *gMicroP = NULL;
+HTCLEO_BATTERY_GAUGE_PROTOCOL *gGauge = NULL;
+EFI_HARDWARE_INTERRUPT_PROTOCOL *gInterrupt = NULL;
+TLMM_GPIO_INTERRUPT *gGpioIrq = NULL;
+
+static BOOLEAN mCableIrq = FALSE;
+static BOOLEAN mOverChargeIrq = FALSE;
+static volatile BOOLEAN mKick = FALSE;
+static BOOLEAN mLastCable = FALSE;
+static UINTN mPollMs = CHARGER_POLL_MIN_MS;
 
 enum PSY_CHARGER_STATE {
 	CHG_OFF,
@@ -76,32 +101,35 @@ void UlpiWrite(unsigned val, unsigned reg)
 
 static void EFIAPI SetCharger(enum PSY_CHARGER_STATE state)
 {
+	UINTN bank, bank2;
+	UINT32 enable, current, value;
+
   gState = state;
+
+	gGpio->PinToBank(HTCLEO_GPIO_BATTERY_CHARGER_ENABLE, &bank, &enable);
+	gGpio->PinToBank(HTCLEO_GPIO_BATTERY_CHARGER_CURRENT, &bank2, &current);
+	ASSERT(bank == bank2);
+
+	// 0 enable; 1 disable;
 	switch (state) {
 		case CHG_USB_LOW:
-			gGpio->Set(HTCLEO_GPIO_BATTERY_CHARGER_ENABLE, 0);
-			gGpio->Config(HTCLEO_GPIO_BATTERY_CHARGER_ENABLE, GPIO_OUTPUT);
-			gGpio->Set(HTCLEO_GPIO_BATTERY_CHARGER_CURRENT, 0);
-			gGpio->Config(HTCLEO_GPIO_BATTERY_CHARGER_CURRENT, GPIO_OUTPUT);
+			value = 0;
 			break;
 		case CHG_AC: case CHG_USB_HIGH:
-			gGpio->Set(HTCLEO_GPIO_BATTERY_CHARGER_CURRENT, 1);
-			gGpio->Config(HTCLEO_GPIO_BATTERY_CHARGER_CURRENT, GPIO_OUTPUT);
-			gGpio->Set(HTCLEO_GPIO_BATTERY_CHARGER_ENABLE, 0);
-			gGpio->Config(HTCLEO_GPIO_BATTERY_CHARGER_ENABLE, GPIO_OUTPUT);
+			value = current;
 			break;
 		case CHG_OFF_FULL_BAT:
 		case CHG_OFF:
 		default:	
-			// 0 enable; 1 disable;
-			gGpio->Set(HTCLEO_GPIO_BATTERY_CHARGER_ENABLE, 1);
-			gGpio->Config(HTCLEO_GPIO_BATTERY_CHARGER_ENABLE, GPIO_OUTPUT);
-			gGpio->Set(HTCLEO_GPIO_BATTERY_CHARGER_CURRENT, 1);
-			gGpio->Config(HTCLEO_GPIO_BATTERY_CHARGER_CURRENT, GPIO_OUTPUT);
+			value = enable | current;
 			/*gGpio->Set(HTCLEO_GPIO_POWER_USB, 0);
 			gGpio->Config(HTCLEO_GPIO_POWER_USB, GPIO_OUTPUT);*/
 			break;
 	}
+
+	// Both pins live in the same bank, switch them in one go
+	gGpio->BankWrite(bank, enable | current, value);
+	gGpio->BankDirection(bank, enable | current, enable | current);
 }
 
 /*
@@ -145,60 +173,116 @@ IsAcOnline()
 	return !!((MmioRead32(USB_PORTSC) & PORTSC_LS) == PORTSC_LS);
 }
 
-VOID EFIAPI WantsCharging(
-    IN EFI_EVENT Event, 
+/*
+ * The charger state is re-evaluated when the cable or charger state
+ * changes and otherwise on a sampling timer that starts fast and backs
+ * off while nothing changes, so an idle charge mostly sits in WFI.
+ */
+static VOID ChargerKick(VOID)
+{
+  mKick = TRUE;
+  gBS->SignalEvent(m_CallbackTimer);
+}
+
+// Modem raised a state change, the cable status word may have moved
+static VOID EFIAPI CableInterruptHandler(
+    IN HARDWARE_INTERRUPT_SOURCE Source,
+    IN EFI_SYSTEM_CONTEXT SystemContext)
+{
+  ChargerKick();
+}
+
+static VOID EFIAPI OverChargeInterruptHandler(
+    IN TLMM_GPIO_PIN Gpio,
+    IN UINTN Level,
     IN VOID *Context)
 {
+  ChargerKick();
+}
+
+/*
+ * Reading the status word is cheap, unlike a charger update. This keeps
+ * cable changes noticed while sampling has backed off, whether or not
+ * the modem interrupt arrives.
+ */
+static VOID EFIAPI CablePoll(
+    IN EFI_EVENT Event,
+    IN VOID *Context)
+{
+  if (CheckUsbStatus() != mLastCable)
+    ChargerKick();
+}
+
+static enum PSY_CHARGER_STATE ChargerWantedState(BOOLEAN Cable)
+{
+  HTCLEO_BATTERY_SAMPLE sample;
   UINT32 voltage = 0;
-  
-  if (CheckUsbStatus())
-  {
-    voltage = ds2746_voltage(DS2746_I2C_SLAVE_ADDR);
-    DEBUG((EFI_D_INFO, "ChargingApp: Battery Voltage is: %d\n", voltage));
-
-    if(voltage < default_chg_voltage_threshold[VOLTAGE_4100]) {
-      DEBUG((EFI_D_INFO, "ChargingApp: Voltage < default_threshold\n"));
-      // If battery needs charging, set new charger state
-      if (IsAcOnline()) {
-        if (gState != CHG_AC ) {
-          MmioWrite32(USB_USBCMD, 0x00080000);
-          UlpiWrite(0x48, 0x04);
-          SetCharger(CHG_AC);
-        }
-      } else {
-        if (gState != CHG_USB_LOW ) {
-          MmioWrite32(USB_USBCMD, 0x00080001);
-          MicroSecondDelay(10);
-          SetCharger(CHG_USB_LOW);
-        }
-      }
-      DEBUG((EFI_D_INFO, "ChargingApp: Charging enabled\n"));
-      // and turn LED amber
-      gMicroP->LedSetMode(LED_AMBER);
-    }
-    else {
-      // Battery is full
-      DEBUG((EFI_D_INFO, "ChargingApp: Voltage >= default_threshold\n"));
-      // Set charger state to CHG_OFF_FULL_BAT
-      if (gState != CHG_OFF_FULL_BAT ) {
+
+  if (!Cable)
+    return CHG_OFF;
+
+  // Never older than the fastest sampling period
+  if (gGauge->GetSample(&sample, CHARGER_POLL_MIN_MS) == 0)
+    voltage = sample.VoltageMv;
+  DEBUG((EFI_D_INFO, "ChargingApp: Battery Voltage is: %d\n", voltage));
+
+  if (voltage >= default_chg_voltage_threshold[VOLTAGE_4100])
+    return CHG_OFF_FULL_BAT;
+
+  return IsAcOnline() ? CHG_AC : CHG_USB_LOW;
+}
+
+VOID EFIAPI ChargerUpdate(
+    IN EFI_EVENT Event, 
+    IN VOID *Context)
+{
+  enum PSY_CHARGER_STATE state;
+  BOOLEAN cable, changed;
+
+  cable = CheckUsbStatus();
+  state = ChargerWantedState(cable);
+  changed = (state != gState);
+
+  if (changed) {
+    DEBUG((EFI_D_INFO, "ChargingApp: state %d -> %d\n", gState, state));
+
+    switch (state) {
+      case CHG_AC:
+        MmioWrite32(USB_USBCMD, 0x00080000);
+        UlpiWrite(0x48, 0x04);
+        break;
+      default:
         MmioWrite32(USB_USBCMD, 0x00080001);
         MicroSecondDelay(10);
-        SetCharger(CHG_OFF_FULL_BAT);
-      }
-      // and turn LED green
-      gMicroP->LedSetMode(LED_GREEN);
+        break;
     }
-  }
-  else {
-    // Set charger state to CHG_OFF
-    if (gState != CHG_OFF ) {
-      MmioWrite32(USB_USBCMD, 0x00080001);
-      MicroSecondDelay(10);
-      SetCharger(CHG_OFF);
+    SetCharger(state);
+
+    switch (state) {
+      case CHG_AC: case CHG_USB_LOW: case CHG_USB_HIGH:
+        gMicroP->LedSetMode(LED_AMBER);
+        break;
+      case CHG_OFF_FULL_BAT:
+        gMicroP->LedSetMode(LED_GREEN);
+        break;
+      case CHG_OFF:
+      default:
+        gMicroP->LedSetMode(LED_OFF);
+        break;
     }
-    // and turn off led
-    gMicroP->LedSetMode(LED_OFF);
   }
+
+  if (mKick || changed || cable != mLastCable)
+    mPollMs = CHARGER_POLL_MIN_MS;
+  else if (cable)
+    mPollMs = MIN(mPollMs * 2, CHARGER_POLL_MAX_MS);
+  else
+    mPollMs = CHARGER_POLL_IDLE_MS;
+
+  mKick = FALSE;
+  mLastCable = cable;
+
+  gBS->SetTimer(m_CallbackTimer, TimerRelative, EFI_TIMER_PERIOD_MILLISECONDS(mPollMs));
 }
 
 VOID
@@ -208,6 +292,16 @@ ExitBootServicesEvent (
   IN VOID       *Context
   )
 {
+  gBS->SetTimer(m_CallbackTimer, TimerCancel, 0);
+  gBS->SetTimer(m_CablePollTimer, TimerCancel, 0);
+  if (mCableIrq) {
+    // Unregistering alone leaves the source enabled at the controller
+    gInterrupt->DisableInterruptSource(gInterrupt, CHARGER_CABLE_IRQ);
+    gInterrupt->RegisterInterruptSource(gInterrupt, CHARGER_CABLE_IRQ, NULL);
+  }
+  if (mOverChargeIrq)
+    gGpioIrq->Unregister(HTCLEO_GPIO_BATTERY_OVER_CHG);
+
   // Set charger state to CHG_OFF
     if (gState != CHG_OFF ) {
       MmioWrite32(USB_USBCMD, 0x00080001);
@@ -234,26 +328,52 @@ ChargingDxeInit(
   Status = gBS->LocateProtocol (&gHtcLeoMicropProtocolGuid, NULL, (VOID **)&gMicroP);
   ASSERT_EFI_ERROR (Status);
 
-  // Install a timer to check for want charging every 100ms
+  // Find the battery gauge protocol.  ASSERT if not found.
+  Status = gBS->LocateProtocol (&gHtcLeoBatteryGaugeProtocolGuid, NULL, (VOID **)&gGauge);
+  ASSERT_EFI_ERROR (Status);
+
+  // Sampling timer, also signaled directly by the cable interrupts
   Status = gBS->CreateEvent (
                 EVT_TIMER | EVT_NOTIFY_SIGNAL,  // Type
-                TPL_NOTIFY,                     // NotifyTpl
-                WantsCharging,                  // NotifyFunction
+                TPL_CALLBACK,                   // NotifyTpl
+                ChargerUpdate,                  // NotifyFunction
                 NULL,                           // NotifyContext
                 &m_CallbackTimer                // Event
                 );
   ASSERT_EFI_ERROR(Status);
 
-  //
-  // Program the timer event to be signaled every 100 ms.
-  //
-  Status = gBS->SetTimer (
-                m_CallbackTimer,
-                TimerPeriodic,
-                EFI_TIMER_PERIOD_MILLISECONDS (100)
+  Status = gBS->CreateEvent (
+                EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                TPL_CALLBACK,
+                CablePoll,
+                NULL,
+                &m_CablePollTimer
                 );
   ASSERT_EFI_ERROR(Status);
 
+  //
+  // Interrupt sources are optional, without them CablePoll still notices
+  // every cable change within CHARGER_CABLE_POLL_MS.
+  //
+  Status = gBS->LocateProtocol (&gHardwareInterruptProtocolGuid, NULL, (VOID **)&gInterrupt);
+  if (!EFI_ERROR(Status)) {
+    Status = gInterrupt->RegisterInterruptSource(gInterrupt, CHARGER_CABLE_IRQ, CableInterruptHandler);
+    mCableIrq = !EFI_ERROR(Status);
+  }
+
+  Status = gBS->LocateProtocol (&gTlmmGpioInterruptProtocolGuid, NULL, (VOID **)&gGpioIrq);
+  if (!EFI_ERROR(Status)) {
+    Status = gGpioIrq->Register(HTCLEO_GPIO_BATTERY_OVER_CHG, GpioTriggerBothEdges,
+                                CHARGER_OVER_CHG_DEBOUNCE_US, OverChargeInterruptHandler, NULL);
+    mOverChargeIrq = !EFI_ERROR(Status);
+  }
+
+  DEBUG((EFI_D_INFO, "ChargingApp: cable irq %d, over charge irq %d\n", mCableIrq, mOverChargeIrq));
+
+  // First evaluation right away
+  ChargerKick();
+  gBS->SetTimer(m_CablePollTimer, TimerPeriodic, EFI_TIMER_PERIOD_MILLISECONDS(CHARGER_CABLE_POLL_MS));
+
   // Register for an ExitBootServicesEvent
   Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY, ExitBootServicesEvent, NULL, &EfiExitBootServicesEvent);
   ASSERT_EFI_ERROR(Status);
@@ -0,0 +1,115 @@
+/** @file
+ * cpufreq Shell command
+ *
+ * Prints the ACPU governor state and how long switching into each
+ * acpu_freq_tbl step actually took.
+ *
+ *  This program and the accompanying materials
+ *  are licensed and made available under the terms and conditions of the BSD License
+ *  which accompanies this distribution.  The full text of the license may be found at
+ *  http://opensource.org/licenses/bsd-license.php
+ *
+ *  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+ *
+**/
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#include <Protocol/ShellDynamicCommand.h>
+#include <Protocol/HtcLeoCpuFreq.h>
+
+HTCLEO_CPU_FREQ_PROTOCOL *gCpuFreq = NULL;
+
+STATIC CONST CHAR16 mCpuFreqHelp[] =
+  L".TH cpufreq 0 \"ACPU frequency statistics\"\r\n"
+  L".SH NAME\r\n"
+  L"Prints the ACPU governor state and per step switch latency.\r\n"
+  L".SH SYNOPSIS\r\n"
+  L"cpufreq\r\n"
+  L".SH DESCRIPTION\r\n"
+  L"Latency runs from the start of a switch until the CPU runs from the\r\n"
+  L"new clock, the AXI vote is not included. Hops slewed the SCPLL in\r\n"
+  L"place, only with PcdAcpuScpllInPlaceHop set. The other switches went\r\n"
+  L"through the MPLL and a full relock.\r\n"
+  L"Switches made while the DGT was stopped have no latency sample.\r\n";
+
+SHELL_STATUS
+EFIAPI
+CpuFreqCommandHandler (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN EFI_SYSTEM_TABLE                    *SystemTable,
+  IN EFI_SHELL_PARAMETERS_PROTOCOL       *ShellParameters,
+  IN EFI_SHELL_PROTOCOL                  *Shell
+  )
+{
+  HTCLEO_CPU_FREQ_STATE       State;
+  HTCLEO_CPU_FREQ_STEP_STATS  Stats;
+  UINT32                      Step;
+
+  if (ShellParameters->Argc > 1) {
+    Print(L"cpufreq: unknown option %s\n", ShellParameters->Argv[1]);
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  gCpuFreq->GetState(&State);
+
+  Print(L"%d kHz (%d - %d), AXI %d kHz, load %d%%, %d pins, %ld transitions\n\n",
+        State.CurrentKhz, State.MinKhz, State.MaxKhz, State.AxiKhz,
+        State.LoadPercent, State.PinCount, State.Transitions);
+
+  Print(L"    kHz  Switches   Hops  Fail  Last(ns)   Avg(ns)   Max(ns)\n");
+  for (Step = 0; gCpuFreq->GetStepStats(Step, &Stats); Step++) {
+    if (Stats.Switches == 0) {
+      continue;
+    }
+    Print(L"%7d %9d %6d %5d %9d %9ld %9d\n",
+          Stats.Khz, Stats.Switches, Stats.Hops, Stats.Failures, Stats.LastNs,
+          Stats.Timed != 0 ? DivU64x32(Stats.TotalNs, Stats.Timed) : 0,
+          Stats.MaxNs);
+  }
+
+  return SHELL_SUCCESS;
+}
+
+CHAR16 *
+EFIAPI
+CpuFreqCommandGetHelp (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN CONST CHAR8                         *Language
+  )
+{
+  // The shell frees the returned string
+  return AllocateCopyPool(sizeof(mCpuFreqHelp), mCpuFreqHelp);
+}
+
+EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL mCpuFreqDynamicCommand = {
+  L"cpufreq",
+  CpuFreqCommandHandler,
+  CpuFreqCommandGetHelp
+};
+
+EFI_STATUS
+EFIAPI
+CpuFreqCommandInitialize (
+  IN EFI_HANDLE         ImageHandle,
+  IN EFI_SYSTEM_TABLE   *SystemTable
+  )
+{
+  EFI_STATUS Status;
+
+  Status = gBS->LocateProtocol(&gHtcLeoCpuFreqProtocolGuid, NULL, (VOID **)&gCpuFreq);
+  ASSERT_EFI_ERROR(Status);
+
+  Status = gBS->InstallMultipleProtocolInterfaces(&ImageHandle,
+                                                  &gEfiShellDynamicCommandProtocolGuid, &mCpuFreqDynamicCommand,
+                                                  NULL);
+  ASSERT_EFI_ERROR(Status);
+
+  return Status;
+}
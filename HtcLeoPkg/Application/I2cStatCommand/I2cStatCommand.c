@@ -0,0 +1,109 @@
+/** @file
+ * i2cstat Shell command
+ *
+ * Prints the transfer counters kept by I2CDxe.
+ *
+ *  This program and the accompanying materials
+ *  are licensed and made available under the terms and conditions of the BSD License
+ *  which accompanies this distribution.  The full text of the license may be found at
+ *  http://opensource.org/licenses/bsd-license.php
+ *
+ *  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+ *
+**/
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#include <Protocol/ShellDynamicCommand.h>
+#include <Protocol/HtcLeoI2C.h>
+
+HTCLEO_I2C_PROTOCOL *gI2C = NULL;
+
+STATIC CONST CHAR16 mI2cStatHelp[] =
+  L".TH i2cstat 0 \"I2C statistics\"\r\n"
+  L".SH NAME\r\n"
+  L"Prints I2C transfer counts, latency and clock gating.\r\n"
+  L".SH SYNOPSIS\r\n"
+  L"i2cstat [-r]\r\n"
+  L".SH OPTIONS\r\n"
+  L"  -r        Reset the counters after printing them\r\n"
+  L".SH DESCRIPTION\r\n"
+  L"Transfer times include turning the controller clock on. Clock enables\r\n"
+  L"counts how often the clock had to be ungated, each one goes to the modem.\r\n";
+
+SHELL_STATUS
+EFIAPI
+I2cStatCommandHandler (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN EFI_SYSTEM_TABLE                    *SystemTable,
+  IN EFI_SHELL_PARAMETERS_PROTOCOL       *ShellParameters,
+  IN EFI_SHELL_PROTOCOL                  *Shell
+  )
+{
+  HTCLEO_I2C_STATS  Stats;
+  BOOLEAN           Reset = FALSE;
+  UINTN             Arg;
+
+  for (Arg = 1; Arg < ShellParameters->Argc; Arg++) {
+    if (StrCmp(ShellParameters->Argv[Arg], L"-r") == 0) {
+      Reset = TRUE;
+    } else {
+      Print(L"i2cstat: unknown option %s\n", ShellParameters->Argv[Arg]);
+      return SHELL_INVALID_PARAMETER;
+    }
+  }
+
+  gI2C->GetStats(&Stats, Reset);
+
+  Print(L"%ld transfers, %ld failed, %ld clock enables\n",
+        Stats.Transfers, Stats.Errors, Stats.ClockEnables);
+  Print(L"Total %ld ns, avg %ld ns, max %ld ns\n",
+        Stats.TotalTimeNs,
+        Stats.Transfers != 0 ? DivU64x64Remainder(Stats.TotalTimeNs, Stats.Transfers, NULL) : 0,
+        Stats.MaxTimeNs);
+
+  return SHELL_SUCCESS;
+}
+
+CHAR16 *
+EFIAPI
+I2cStatCommandGetHelp (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN CONST CHAR8                         *Language
+  )
+{
+  // The shell frees the returned string
+  return AllocateCopyPool(sizeof(mI2cStatHelp), mI2cStatHelp);
+}
+
+EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL mI2cStatDynamicCommand = {
+  L"i2cstat",
+  I2cStatCommandHandler,
+  I2cStatCommandGetHelp
+};
+
+EFI_STATUS
+EFIAPI
+I2cStatCommandInitialize (
+  IN EFI_HANDLE         ImageHandle,
+  IN EFI_SYSTEM_TABLE   *SystemTable
+  )
+{
+  EFI_STATUS Status;
+
+  Status = gBS->LocateProtocol(&gHtcLeoI2CProtocolGuid, NULL, (VOID **)&gI2C);
+  ASSERT_EFI_ERROR(Status);
+
+  Status = gBS->InstallMultipleProtocolInterfaces(&ImageHandle,
+                                                  &gEfiShellDynamicCommandProtocolGuid, &mI2cStatDynamicCommand,
+                                                  NULL);
+  ASSERT_EFI_ERROR(Status);
+
+  return Status;
+}
@@ -0,0 +1,145 @@
+/** @file
+ * irqstat Shell command
+ *
+ * Prints the per source statistics collected by InterruptDxe, along with
+ * the time all DXE modules spent in TimerLib delays.
+ *
+ *  This program and the accompanying materials
+ *  are licensed and made available under the terms and conditions of the BSD License
+ *  which accompanies this distribution.  The full text of the license may be found at
+ *  http://opensource.org/licenses/bsd-license.php
+ *
+ *  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+ *
+**/
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#include <Protocol/ShellDynamicCommand.h>
+#include <Protocol/HtcLeoInterruptControl.h>
+
+HTCLEO_INTERRUPT_CONTROL_PROTOCOL *gIrqControl = NULL;
+
+STATIC CONST CHAR16 mIrqStatHelp[] =
+  L".TH irqstat 0 \"Interrupt statistics\"\r\n"
+  L".SH NAME\r\n"
+  L"Prints per interrupt source counters collected by InterruptDxe and\r\n"
+  L"the time DXE modules spent in MicroSecondDelay.\r\n"
+  L".SH SYNOPSIS\r\n"
+  L"irqstat [-r]\r\n"
+  L".SH OPTIONS\r\n"
+  L"  -r  Reset all counters after printing them\r\n";
+
+SHELL_STATUS
+EFIAPI
+IrqStatCommandHandler (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN EFI_SYSTEM_TABLE                    *SystemTable,
+  IN EFI_SHELL_PARAMETERS_PROTOCOL       *ShellParameters,
+  IN EFI_SHELL_PROTOCOL                  *Shell
+  )
+{
+  HTCLEO_INTERRUPT_STATS Stats;
+  HTCLEO_DELAY_STATS     Delays;
+  BOOLEAN                Reset = FALSE;
+  UINTN                  Source;
+  UINT64                 IdleTicks;
+  UINT64                 Ticks;
+
+  if (ShellParameters->Argc > 2) {
+    return SHELL_INVALID_PARAMETER;
+  }
+
+  if (ShellParameters->Argc == 2) {
+    if (StrCmp(ShellParameters->Argv[1], L"-r") != 0) {
+      Print(L"irqstat: unknown option %s\n", ShellParameters->Argv[1]);
+      return SHELL_INVALID_PARAMETER;
+    }
+    Reset = TRUE;
+  }
+
+  Print(L"IRQ        Count   Avg(us)   Max(us)  AvgLat(us)  MaxLat(us)\n");
+
+  for (Source = 0; Source < gIrqControl->NumberOfSources; Source++) {
+    if (EFI_ERROR(gIrqControl->GetStats(Source, &Stats)) || Stats.Count == 0) {
+      continue;
+    }
+
+    Print(L"%3d %12ld %9ld %9d",
+          Source,
+          Stats.Count,
+          DivU64x64Remainder(Stats.TotalTimeNs, Stats.Count, NULL) / 1000,
+          Stats.MaxTimeNs / 1000);
+
+    if (Stats.LatencySamples != 0) {
+      Print(L" %11ld %11d\n",
+            DivU64x64Remainder(Stats.TotalLatencyNs, Stats.LatencySamples, NULL) / 1000,
+            Stats.MaxLatencyNs / 1000);
+    } else {
+      Print(L" %11s %11s\n", L"-", L"-");
+    }
+  }
+
+  gIrqControl->GetIdleStats(&IdleTicks, &Ticks);
+  if (Ticks != 0) {
+    Print(L"\nIdle: %ld of %ld timer ticks in WFI (%ld%%)\n",
+          IdleTicks, Ticks, DivU64x64Remainder(IdleTicks * 100, Ticks, NULL));
+  }
+
+  gIrqControl->GetDelayStats(&Delays);
+  if (Delays.Calls != 0) {
+    Print(L"Delays: %ld calls, %ld ms total, %ld ms in WFI over %ld calls\n",
+          Delays.Calls, DivU64x32(Delays.TotalUs, 1000),
+          DivU64x32(Delays.SleptUs, 1000), Delays.SleepCalls);
+    Print(L"Longest delay: %d us from %p\n", Delays.MaxUs, Delays.MaxCaller);
+  }
+
+  if (Reset) {
+    gIrqControl->ResetStats();
+  }
+
+  return SHELL_SUCCESS;
+}
+
+CHAR16 *
+EFIAPI
+IrqStatCommandGetHelp (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN CONST CHAR8                         *Language
+  )
+{
+  // The shell frees the returned string
+  return AllocateCopyPool(sizeof(mIrqStatHelp), mIrqStatHelp);
+}
+
+EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL mIrqStatDynamicCommand = {
+  L"irqstat",
+  IrqStatCommandHandler,
+  IrqStatCommandGetHelp
+};
+
+EFI_STATUS
+EFIAPI
+IrqStatCommandInitialize (
+  IN EFI_HANDLE         ImageHandle,
+  IN EFI_SYSTEM_TABLE   *SystemTable
+  )
+{
+  EFI_STATUS Status;
+
+  Status = gBS->LocateProtocol(&gHtcLeoInterruptControlProtocolGuid, NULL, (VOID **)&gIrqControl);
+  ASSERT_EFI_ERROR(Status);
+
+  Status = gBS->InstallMultipleProtocolInterfaces(&ImageHandle,
+                                                  &gEfiShellDynamicCommandProtocolGuid, &mIrqStatDynamicCommand,
+                                                  NULL);
+  ASSERT_EFI_ERROR(Status);
+
+  return Status;
+}
@@ -0,0 +1,257 @@
+/** @file
+ * pcomstat Shell command
+ *
+ * Summarizes the proc_comm trace kept by PcomDxe per command: call
+ * counts, time spent and a latency histogram.
+ *
+ *  This program and the accompanying materials
+ *  are licensed and made available under the terms and conditions of the BSD License
+ *  which accompanies this distribution.  The full text of the license may be found at
+ *  http://opensource.org/licenses/bsd-license.php
+ *
+ *  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+ *
+**/
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#include <Protocol/ShellDynamicCommand.h>
+#include <Protocol/HtcLeoPcom.h>
+
+// Histogram buckets double from 64us, the last one is open ended
+#define PCOM_HIST_BUCKETS   8
+#define PCOM_HIST_FIRST_US  64
+
+// Distinct command (and argument) keys summarized
+#define PCOM_STAT_KEYS      64
+
+typedef struct {
+  UINT32  Command;
+  UINT32  Arg1;
+  UINTN   Count;
+  UINTN   Failed;
+  UINT64  TotalUs;
+  UINT32  MaxUs;
+  UINTN   Hist[PCOM_HIST_BUCKETS];
+} PCOM_STAT_KEY;
+
+HTCLEO_PCOM_PROTOCOL *gPcom = NULL;
+
+STATIC CONST CHAR16 mPcomStatHelp[] =
+  L".TH pcomstat 0 \"proc_comm statistics\"\r\n"
+  L".SH NAME\r\n"
+  L"Prints per command proc_comm call counts and latency histograms.\r\n"
+  L".SH SYNOPSIS\r\n"
+  L"pcomstat [-a] [-t count] [-r]\r\n"
+  L".SH OPTIONS\r\n"
+  L"  -a        Split each command by its first argument (clock, vreg, gpio)\r\n"
+  L"  -t count  Also list the last count commands\r\n"
+  L"  -r        Reset the trace and counters after printing them\r\n"
+  L".SH DESCRIPTION\r\n"
+  L"Only the last 512 commands are kept, commands issued before PcomDxe\r\n"
+  L"loaded are not traced. Latency is measured from issue to completion,\r\n"
+  L"Queue is the time spent waiting behind other commands.\r\n";
+
+STATIC UINTN PcomHistBucket(UINT32 Us)
+{
+  UINTN Bucket;
+
+  if (Us < PCOM_HIST_FIRST_US) {
+    return 0;
+  }
+
+  Bucket = HighBitSet32(Us / PCOM_HIST_FIRST_US) + 1;
+  return MIN(Bucket, PCOM_HIST_BUCKETS - 1);
+}
+
+STATIC UINTN PcomSummarize(
+  HTCLEO_PCOM_TRACE_ENTRY *Trace,
+  UINTN                   Count,
+  BOOLEAN                 ByArg,
+  PCOM_STAT_KEY           *Keys
+  )
+{
+  PCOM_STAT_KEY *Key;
+  UINTN         NumKeys = 0;
+  UINTN         n, k;
+
+  for (n = 0; n < Count; n++) {
+    for (k = 0; k < NumKeys; k++) {
+      if (Keys[k].Command == Trace[n].Command && (!ByArg || Keys[k].Arg1 == Trace[n].Data1)) {
+        break;
+      }
+    }
+
+    if (k == NumKeys) {
+      if (NumKeys == PCOM_STAT_KEYS) {
+        continue;
+      }
+      ZeroMem(&Keys[k], sizeof(Keys[k]));
+      Keys[k].Command = Trace[n].Command;
+      Keys[k].Arg1 = Trace[n].Data1;
+      NumKeys++;
+    }
+
+    Key = &Keys[k];
+    Key->Count++;
+    if (Trace[n].Status != 0) {
+      Key->Failed++;
+    }
+    Key->TotalUs += Trace[n].LatencyUs;
+    Key->MaxUs = MAX(Key->MaxUs, Trace[n].LatencyUs);
+    Key->Hist[PcomHistBucket(Trace[n].LatencyUs)]++;
+  }
+
+  return NumKeys;
+}
+
+STATIC VOID PcomSortByTotal(PCOM_STAT_KEY *Keys, UINTN NumKeys)
+{
+  PCOM_STAT_KEY Tmp;
+  UINTN         i, j, Max;
+
+  for (i = 0; i + 1 < NumKeys; i++) {
+    Max = i;
+    for (j = i + 1; j < NumKeys; j++) {
+      if (Keys[j].TotalUs > Keys[Max].TotalUs) {
+        Max = j;
+      }
+    }
+    if (Max != i) {
+      CopyMem(&Tmp, &Keys[i], sizeof(Tmp));
+      CopyMem(&Keys[i], &Keys[Max], sizeof(Tmp));
+      CopyMem(&Keys[Max], &Tmp, sizeof(Tmp));
+    }
+  }
+}
+
+SHELL_STATUS
+EFIAPI
+PcomStatCommandHandler (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN EFI_SYSTEM_TABLE                    *SystemTable,
+  IN EFI_SHELL_PARAMETERS_PROTOCOL       *ShellParameters,
+  IN EFI_SHELL_PROTOCOL                  *Shell
+  )
+{
+  struct pcom_stats       Stats;
+  HTCLEO_PCOM_TRACE_ENTRY *Trace;
+  PCOM_STAT_KEY           *Keys;
+  UINT64                  Total;
+  UINTN                   Count, NumKeys, Tail = 0;
+  UINTN                   Arg, n, b;
+  BOOLEAN                 Reset = FALSE;
+  BOOLEAN                 ByArg = FALSE;
+
+  for (Arg = 1; Arg < ShellParameters->Argc; Arg++) {
+    if (StrCmp(ShellParameters->Argv[Arg], L"-r") == 0) {
+      Reset = TRUE;
+    } else if (StrCmp(ShellParameters->Argv[Arg], L"-a") == 0) {
+      ByArg = TRUE;
+    } else if (StrCmp(ShellParameters->Argv[Arg], L"-t") == 0 && Arg + 1 < ShellParameters->Argc) {
+      Tail = StrDecimalToUintn(ShellParameters->Argv[++Arg]);
+    } else {
+      Print(L"pcomstat: unknown option %s\n", ShellParameters->Argv[Arg]);
+      return SHELL_INVALID_PARAMETER;
+    }
+  }
+
+  Trace = AllocatePool(PCOM_TRACE_ENTRIES * sizeof(*Trace));
+  Keys = AllocatePool(PCOM_STAT_KEYS * sizeof(*Keys));
+  if (Trace == NULL || Keys == NULL) {
+    if (Trace != NULL) FreePool(Trace);
+    if (Keys != NULL) FreePool(Keys);
+    return SHELL_OUT_OF_RESOURCES;
+  }
+
+  // Snapshot both together so the counters match the trace
+  gPcom->GetStats(&Stats);
+  Count = gPcom->GetTrace(Trace, PCOM_TRACE_ENTRIES, &Total);
+  if (Reset) {
+    gPcom->ResetTrace();
+  }
+
+  Print(L"%d calls, %d failed, %d timed out, %d retries, %ld us busy, max %d us (cmd 0x%x)\n",
+        Stats.calls, Stats.failures, Stats.timeouts, Stats.retries,
+        Stats.total_us, Stats.max_us, Stats.max_cmd);
+  Print(L"Trace holds the last %d of %ld commands\n\n", Count, Total);
+
+  NumKeys = PcomSummarize(Trace, Count, ByArg, Keys);
+  PcomSortByTotal(Keys, NumKeys);
+
+  Print(L"Cmd  %8s  Count Fail  Total(us) Avg(us) Max(us)   <64  <128  <256  <512   <1m   <2m   <4m  >=4m\n",
+        ByArg ? L"Arg1" : L"");
+  for (n = 0; n < NumKeys; n++) {
+    if (ByArg) {
+      Print(L"0x%02x %8x", Keys[n].Command, Keys[n].Arg1);
+    } else {
+      Print(L"0x%02x %8s", Keys[n].Command, L"");
+    }
+    Print(L" %6d %4d %10ld %7ld %7d",
+          Keys[n].Count, Keys[n].Failed, Keys[n].TotalUs,
+          DivU64x32(Keys[n].TotalUs, (UINT32)Keys[n].Count), Keys[n].MaxUs);
+    for (b = 0; b < PCOM_HIST_BUCKETS; b++) {
+      Print(L" %5d", Keys[n].Hist[b]);
+    }
+    Print(L"\n");
+  }
+
+  if (Tail != 0) {
+    Tail = MIN(Tail, Count);
+    Print(L"\n   Start(us)  Cmd      Data1      Data2 Status Queue(us) Latency(us)\n");
+    for (n = Count - Tail; n < Count; n++) {
+      Print(L"%12d 0x%02x 0x%08x 0x%08x %6d %9d %11d\n",
+            Trace[n].StartUs, Trace[n].Command, Trace[n].Data1, Trace[n].Data2,
+            Trace[n].Status, Trace[n].QueueUs, Trace[n].LatencyUs);
+    }
+  }
+
+  FreePool(Keys);
+  FreePool(Trace);
+
+  return SHELL_SUCCESS;
+}
+
+CHAR16 *
+EFIAPI
+PcomStatCommandGetHelp (
+  IN EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL  *This,
+  IN CONST CHAR8                         *Language
+  )
+{
+  // The shell frees the returned string
+  return AllocateCopyPool(sizeof(mPcomStatHelp), mPcomStatHelp);
+}
+
+EFI_SHELL_DYNAMIC_COMMAND_PROTOCOL mPcomStatDynamicCommand = {
+  L"pcomstat",
+  PcomStatCommandHandler,
+  PcomStatCommandGetHelp
+};
+
+EFI_STATUS
+EFIAPI
+PcomStatCommandInitialize (
+  IN EFI_HANDLE         ImageHandle,
+  IN EFI_SYSTEM_TABLE   *SystemTable
+  )
+{
+  EFI_STATUS Status;
+
+  Status = gBS->LocateProtocol(&gHtcLeoPcomProtocolGuid, NULL, (VOID **)&gPcom);
+  ASSERT_EFI_ERROR(Status);
+
+  Status = gBS->InstallMultipleProtocolInterfaces(&ImageHandle,
+                                                  &gEfiShellDynamicCommandProtocolGuid, &mPcomStatDynamicCommand,
+                                                  NULL);
+  ASSERT_EFI_ERROR(Status);
+
+  return Status;
+}
@@ -0,0 +1,222 @@
+/*
+ * DS2746 battery gauge sampler
+ *
+ * All consumers share one cached sample, the gauge is only read again
+ * once the sample is older than the age a caller accepts. Each read is a
+ * single burst of the whole result block. The I2C transfer runs at the
+ * caller's TPL, a busy flag keeps reads from nesting.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/DS2746.h>
+
+#include <Device/Gpio.h>
+#include <Protocol/HtcLeoBatteryGauge.h>
+
+// Internal resistance used to estimate the open circuit voltage
+#define BATTERY_RINT_MOHM		150
+
+// Filter weight of a new sample, in 1/256 steps
+#define SOC_FILTER_WEIGHT		32
+
+typedef struct {
+	UINT32 mv;
+	UINT8 soc;
+} OCV_POINT;
+
+// Typical Li-ion open circuit voltage curve
+STATIC CONST OCV_POINT mOcvCurve[] = {
+	{ DS2746_LOW_VOLTAGE,	0 },
+	{ 3500,	5 },
+	{ 3600,	10 },
+	{ 3700,	25 },
+	{ 3750,	40 },
+	{ 3800,	55 },
+	{ 3850,	65 },
+	{ 3900,	72 },
+	{ 4000,	82 },
+	{ 4100,	92 },
+	{ DS2746_HIGH_VOLTAGE,	100 },
+};
+
+STATIC HTCLEO_BATTERY_SAMPLE mSample;
+STATIC BOOLEAN mSampleValid = FALSE;
+// Set while somebody owns the gauge and the cached sample
+STATIC BOOLEAN mBusy = FALSE;
+
+// Filtered state of charge, 8 fractional bits
+STATIC UINT32 mSocFiltered;
+STATIC BOOLEAN mSocSeeded = FALSE;
+
+STATIC UINT8 GaugeOcvToSoc(INT32 mv)
+{
+	UINTN i;
+
+	if (mv <= (INT32)mOcvCurve[0].mv)
+		return 0;
+
+	for (i = 1; i < ARRAY_SIZE(mOcvCurve); i++) {
+		if (mv < (INT32)mOcvCurve[i].mv) {
+			CONST OCV_POINT *lo = &mOcvCurve[i - 1];
+			CONST OCV_POINT *hi = &mOcvCurve[i];
+
+			return lo->soc + ((mv - lo->mv) * (hi->soc - lo->soc)) / (hi->mv - lo->mv);
+		}
+	}
+
+	return 100;
+}
+
+/*
+ * Single CPU: finding the gauge busy means we interrupted its owner, so
+ * fail right away instead of waiting on it.
+ */
+STATIC BOOLEAN GaugeClaim(VOID)
+{
+	EFI_TPL OldTpl;
+	BOOLEAN claimed = FALSE;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	if (!mBusy) {
+		mBusy = TRUE;
+		claimed = TRUE;
+	}
+	gBS->RestoreTPL(OldTpl);
+
+	return claimed;
+}
+
+STATIC VOID GaugeRelease(VOID)
+{
+	mBusy = FALSE;
+}
+
+STATIC INTN GaugeRefreshLocked(VOID)
+{
+	DS2746_REGS regs;
+	INT32 ocv;
+
+	if (ds2746_read_block(DS2746_I2C_SLAVE_ADDR, &regs) < 0) {
+		DEBUG((EFI_D_ERROR, "BatteryGauge: gauge read failed\n"));
+		return -1;
+	}
+
+	mSample.TimestampNs = GetTimeInNanoSecond(GetPerformanceCounter());
+	mSample.VoltageMv = ds2746_voltage_mv(&regs);
+	mSample.CurrentMa = ds2746_current_ma(&regs, DS2746_DEFAULT_RSNS);
+	mSample.CurrentAccum = regs.current_accum;
+	mSample.Aux0 = regs.aux0;
+	mSample.Aux1 = regs.aux1;
+
+	// Charging current lifts the terminal voltage, discharge sags it
+	ocv = (INT32)mSample.VoltageMv - (mSample.CurrentMa * BATTERY_RINT_MOHM) / 1000;
+	mSample.SocRaw = GaugeOcvToSoc(ocv);
+
+	if (!mSocSeeded) {
+		mSocFiltered = mSample.SocRaw << 8;
+		mSocSeeded = TRUE;
+	} else {
+		mSocFiltered = (mSocFiltered * (256 - SOC_FILTER_WEIGHT) +
+				(mSample.SocRaw << 8) * SOC_FILTER_WEIGHT) >> 8;
+	}
+	mSample.Soc = (mSocFiltered + 128) >> 8;
+
+	mSampleValid = TRUE;
+	return 0;
+}
+
+INTN GaugeRefresh(HTCLEO_BATTERY_SAMPLE *Sample)
+{
+	INTN ret;
+
+	if (!GaugeClaim())
+		return -1;
+
+	ret = GaugeRefreshLocked();
+	if (ret == 0 && Sample)
+		CopyMem(Sample, &mSample, sizeof(mSample));
+	GaugeRelease();
+
+	return ret;
+}
+
+INTN GaugeGetSample(HTCLEO_BATTERY_SAMPLE *Sample, UINTN MaxAgeMs)
+{
+	UINT64 now;
+	INTN ret = 0;
+
+	if (!Sample)
+		return -1;
+
+	if (MaxAgeMs == 0)
+		MaxAgeMs = PcdGet32(PcdBatteryGaugeMaxAgeMs);
+
+	if (!GaugeClaim())
+		return -1;
+
+	now = GetTimeInNanoSecond(GetPerformanceCounter());
+	if (!mSampleValid || now - mSample.TimestampNs > MultU64x32(MaxAgeMs, 1000000))
+		ret = GaugeRefreshLocked();
+
+	// A failed read still hands out the last good sample, its age shows
+	if (mSampleValid)
+		CopyMem(Sample, &mSample, sizeof(mSample));
+	else
+		ret = -1;
+	GaugeRelease();
+
+	return ret;
+}
+
+VOID GaugeResetFilter(VOID)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	mSocSeeded = FALSE;
+	mSampleValid = FALSE;
+	gBS->RestoreTPL(OldTpl);
+}
+
+HTCLEO_BATTERY_GAUGE_PROTOCOL gHtcLeoBatteryGaugeProtocol = {
+	GaugeGetSample,
+	GaugeRefresh,
+	GaugeResetFilter
+};
+
+EFI_STATUS
+EFIAPI
+BatteryGaugeDxeInitialize(
+	IN EFI_HANDLE         ImageHandle,
+	IN EFI_SYSTEM_TABLE   *SystemTable
+)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE Handle = NULL;
+
+	// A gauge that fails now may answer later, every sample call reports it
+	if (GaugeRefresh(NULL) == 0)
+		DEBUG((EFI_D_INFO, "BatteryGauge: %d mV, %d mA, %d%%\n",
+			mSample.VoltageMv, mSample.CurrentMa, mSample.Soc));
+
+	Status = gBS->InstallMultipleProtocolInterfaces(
+		&Handle, &gHtcLeoBatteryGaugeProtocolGuid, &gHtcLeoBatteryGaugeProtocol, NULL);
+	ASSERT_EFI_ERROR(Status);
+
+	return Status;
+}
@@ -11,6 +11,7 @@
 STATIC KEYPAD_DEVICE_PROTOCOL mInternalKeypadDevice = {
     KeypadDeviceImplReset,
     KeypadDeviceImplGetKeys,
+    KeypadDeviceImplArm,
 };
 
 EFI_STATUS
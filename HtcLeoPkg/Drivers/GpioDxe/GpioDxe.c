@@ -55,11 +55,28 @@
 #include <Chipset/clock.h>
 
 #include <Protocol/GpioTlmm.h>
+#include <Protocol/GpioTlmmInterrupt.h>
 #include <Protocol/HardwareInterrupt.h>
 
 // Cached copy of the Hardware Interrupt protocol instance
 EFI_HARDWARE_INTERRUPT_PROTOCOL *gInterrupt = NULL;
 
+typedef struct {
+	TLMM_GPIO_INTERRUPT_HANDLER Handler;
+	VOID                        *Context;
+	TLMM_GPIO_TRIGGER           Trigger;
+	UINT64                      Debounce;   // 100ns units, 0 = none
+	EFI_EVENT                   DebounceEvent;
+	BOOLEAN                     DebouncePending;
+	BOOLEAN                     Masked;     // by the consumer
+	UINTN                       LastLevel;
+} GPIO_IRQ_DESC;
+
+STATIC GPIO_IRQ_DESC mGpioIrq[NR_GPIO_IRQS];
+
+// Signalled from the ISR, arms the debounce timers at TPL_NOTIFY
+STATIC EFI_EVENT mDebounceArmEvent;
+
 static gpioregs GPIO_REGS[] = {
 	{
 	.out 		= GPIO_OUT_0,
@@ -167,23 +184,28 @@ static gpioregs GPIO_REGS[] = {
 	},
 };
 
+/* pin -> GPIO_REGS index, filled from the bank ranges at init */
+static UINT8 gpio_bank[NR_GPIO_IRQS];
+
+static void gpio_bank_init(void)
+{
+	for (UINTN i = 0; i < ARRAY_SIZE(GPIO_REGS); i++)
+		for (UINTN n = GPIO_REGS[i].start; n <= GPIO_REGS[i].end; n++)
+			gpio_bank[n] = i;
+}
+
 static
 gpioregs
 *find_gpio(UINTN n, UINTN *bit)
 {
-	gpioregs *ret = 0;
-	if (n > GPIO_REGS[ARRAY_SIZE(GPIO_REGS) - 1].end)
-		goto end;
+	gpioregs *ret;
 
-	for (UINTN i = 0; i < ARRAY_SIZE(GPIO_REGS); i++) {
-		ret = GPIO_REGS + i;
-		if (n >= ret->start && n <= ret->end) {
-			*bit = 1 << (n - ret->start);
-			break;
-		}
-	}
+	if (n >= NR_GPIO_IRQS)
+		return 0;
+
+	ret = GPIO_REGS + gpio_bank[n];
+	*bit = 1 << (n - ret->start);
 
-end:
 	return ret;
 }
 
@@ -192,17 +214,15 @@ gpio_config(UINTN n, UINTN flags)
 {
 	gpioregs *r;
 	UINTN b = 0;
-	UINTN v;
+	UINTN v, nv;
 
 	if ((r = find_gpio(n, &b)) == 0)
 		return -1;
 
 	v = readl(r->oe);
-	if (flags & GPIO_OUTPUT) {
-		writel(v | b, r->oe);
-	} else {
-		writel(v & (~b), r->oe);
-	}
+	nv = (flags & GPIO_OUTPUT) ? (v | b) : (v & ~b);
+	if (nv != v)
+		writel(nv, r->oe);
 	
 	return 0;
 }
@@ -227,6 +247,53 @@ gpio_set(UINTN n, UINTN on)
 	}
 }
 
+EFI_STATUS
+gpio_pin_to_bank(UINTN n, UINTN *bank, UINT32 *mask)
+{
+	UINTN b = 0;
+
+	if (find_gpio(n, &b) == 0)
+		return EFI_INVALID_PARAMETER;
+
+	*bank = gpio_bank[n];
+	*mask = b;
+
+	return EFI_SUCCESS;
+}
+
+UINT32
+gpio_bank_read(UINTN bank)
+{
+	if (bank >= ARRAY_SIZE(GPIO_REGS))
+		return 0;
+
+	return readl(GPIO_REGS[bank].in);
+}
+
+VOID
+gpio_bank_write(UINTN bank, UINT32 mask, UINT32 value)
+{
+	gpioregs *r;
+
+	if (bank >= ARRAY_SIZE(GPIO_REGS))
+		return;
+
+	r = GPIO_REGS + bank;
+	writel((readl(r->out) & ~mask) | (value & mask), r->out);
+}
+
+VOID
+gpio_bank_direction(UINTN bank, UINT32 mask, UINT32 output)
+{
+	gpioregs *r;
+
+	if (bank >= ARRAY_SIZE(GPIO_REGS))
+		return;
+
+	r = GPIO_REGS + bank;
+	writel((readl(r->oe) & ~mask) | (output & mask), r->oe);
+}
+
 UINTN
 gpio_get(UINTN n)
 {
@@ -241,15 +308,78 @@ gpio_get(UINTN n)
 	return (readl(r->in) & b) ? 1 : 0;
 }
 
-VOID
-config_gpio_table(UINT32 *table, int len)
+/*
+ * Pads of pins the apps processor owns are programmed straight through the
+ * TLMM page/config registers, saving a modem round trip per pin.
+ * Returns -1 if the pin has to go through proc_comm instead.
+ */
+static int
+gpio_tlmm_config_native(UINT32 config)
 {
-	int n;
-	UINTN id;
+	gpioregs *r;
+	UINTN gpio = MSM_GPIO_PIN(config);
+	UINTN b = 0;
+	UINT32 val;
+	EFI_TPL OldTpl;
+
+	if ((r = find_gpio(gpio, &b)) == 0)
+		return -1;
+
+	if (!(readl(r->owner) & b))
+		return -1;
+
+	val = GPIO_CFG_PULL(MSM_GPIO_PULL(config)) |
+	      GPIO_CFG_FUNC(MSM_GPIO_FUNC(config)) |
+	      GPIO_CFG_DRVSTR(MSM_GPIO_DRVSTR(config));
+
+	// PAGE selects the pin CFG refers to, keep the pair atomic
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	writel(gpio, GPIO1_PAGE);
+	writel(val, GPIO1_CFG);
+	if ((readl(GPIO1_CFG) & GPIO_CFG_MASK) != val) {
+		gBS->RestoreTPL(OldTpl);
+		return -1;
+	}
+	gBS->RestoreTPL(OldTpl);
+
+	gpio_bank_direction(gpio_bank[gpio], b, MSM_GPIO_DIR(config) ? b : 0);
+
+	return 0;
+}
+
+EFI_STATUS
+gpio_tlmm_config_table(CONST UINT32 *table, UINTN len, UINTN disable)
+{
+	struct pcom_cmd batch[PCOM_BATCH_MAX];
+	UINTN n, queued = 0;
+	EFI_STATUS Status = EFI_SUCCESS;
+
+	// Pins left for the modem are sent as one proc_comm batch
 	for (n = 0; n < len; n++) {
-		id = table[n];
-		msm_proc_comm(PCOM_RPC_GPIO_TLMM_CONFIG_EX, &id, 0);
+		// The modem also owns the low power state of disabled pads
+		if (disable == MSM_GPIO_CFG_ENABLE && gpio_tlmm_config_native(table[n]) == 0)
+			continue;
+
+		batch[queued].cmd = PCOM_RPC_GPIO_TLMM_CONFIG_EX;
+		batch[queued].data1 = table[n];
+		batch[queued].data2 = disable;
+		if (++queued == PCOM_BATCH_MAX) {
+			if (msm_proc_comm_batch(batch, queued))
+				Status = EFI_DEVICE_ERROR;
+			queued = 0;
+		}
 	}
+
+	if (queued && msm_proc_comm_batch(batch, queued))
+		Status = EFI_DEVICE_ERROR;
+
+	return Status;
+}
+
+VOID
+config_gpio_table(UINT32 *table, int len)
+{
+	gpio_tlmm_config_table(table, len, MSM_GPIO_CFG_ENABLE);
 }
 
 /*void msm_gpio_set_owner(UINTN gpio, UINTN owner)
@@ -281,12 +411,13 @@ static void msm_gpio_update_both_edge_detect(UINTN gpio)
 	int loop_limit = 100;
 	UINTN pol, val, val2, intstat;
 	do {
-		val = readl(r->in);
+		// Arm the opposite edge of the current level, this pin only
+		val = readl(r->in) & b;
 		pol = readl(r->int_pos);
-		pol |= ~val;
+		pol = (pol & ~b) | (~val & b);
 		writel(pol, r->int_pos);
-		intstat = readl(r->int_status);
-		val2 = readl(r->in);
+		intstat = readl(r->int_status) & b;
+		val2 = readl(r->in) & b;
 		if (((val ^ val2) & ~intstat) == 0)
 			return;
 	} while (loop_limit-- > 0);
@@ -309,7 +440,146 @@ static int msm_gpio_irq_clear(UINTN gpio)
 static void msm_gpio_irq_ack(UINTN gpio)
 {
 	msm_gpio_irq_clear(gpio);
-	msm_gpio_update_both_edge_detect(gpio);
+	if (mGpioIrq[gpio].Trigger == GpioTriggerBothEdges)
+		msm_gpio_update_both_edge_detect(gpio);
+}
+
+static void msm_gpio_irq_mask(UINTN gpio)
+{
+	gpioregs *r;
+	UINTN b = 0;
+
+	if ((r = find_gpio(gpio, &b)) == 0)
+		return;
+
+	writel(readl(r->int_en) & ~b, r->int_en);
+}
+
+static void msm_gpio_irq_unmask(UINTN gpio)
+{
+	gpioregs *r;
+	UINTN b = 0;
+
+	if ((r = find_gpio(gpio, &b)) == 0)
+		return;
+
+	msm_gpio_irq_ack(gpio);
+	writel(readl(r->int_en) | b, r->int_en);
+}
+
+static void msm_gpio_irq_set_type(UINTN gpio, TLMM_GPIO_TRIGGER trigger)
+{
+	gpioregs *r;
+	UINTN b = 0;
+	UINTN edge, pos;
+
+	if ((r = find_gpio(gpio, &b)) == 0)
+		return;
+
+	edge = readl(r->int_edge);
+	pos = readl(r->int_pos);
+
+	switch (trigger) {
+	case GpioTriggerRising:
+	case GpioTriggerLevelHigh:
+		pos |= b;
+		break;
+	case GpioTriggerFalling:
+	case GpioTriggerLevelLow:
+		pos &= ~b;
+		break;
+	default:
+		break;
+	}
+
+	if (trigger == GpioTriggerLevelHigh || trigger == GpioTriggerLevelLow)
+		edge &= ~b;
+	else
+		edge |= b;
+
+	writel(edge, r->int_edge);
+	writel(pos, r->int_pos);
+
+	if (trigger == GpioTriggerBothEdges)
+		msm_gpio_update_both_edge_detect(gpio);
+}
+
+/*
+ * Decide whether a sampled level satisfies the trigger of a pin.
+ * Both-edge pins fire on any change of the last reported level.
+ */
+static BOOLEAN msm_gpio_irq_matches(GPIO_IRQ_DESC *desc, UINTN level)
+{
+	switch (desc->Trigger) {
+	case GpioTriggerRising:
+	case GpioTriggerLevelHigh:
+		return level != 0;
+	case GpioTriggerFalling:
+	case GpioTriggerLevelLow:
+		return level == 0;
+	case GpioTriggerBothEdges:
+		return level != desc->LastLevel;
+	default:
+		return FALSE;
+	}
+}
+
+static BOOLEAN msm_gpio_irq_is_level(GPIO_IRQ_DESC *desc)
+{
+	return desc->Trigger == GpioTriggerLevelHigh || desc->Trigger == GpioTriggerLevelLow;
+}
+
+VOID
+EFIAPI
+GpioDebounceTimerNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+	UINTN gpio = (UINTN)Context;
+	GPIO_IRQ_DESC *desc = &mGpioIrq[gpio];
+	gpioregs *r;
+	UINTN b = 0;
+	UINTN level;
+
+	if (desc->Handler == NULL || (r = find_gpio(gpio, &b)) == 0)
+		return;
+
+	level = (readl(r->in) & b) ? 1 : 0;
+
+	if (msm_gpio_irq_matches(desc, level)) {
+		desc->LastLevel = level;
+		desc->Handler(gpio, level, desc->Context);
+
+		// Level sources stay masked until the consumer services them
+		if (msm_gpio_irq_is_level(desc))
+			return;
+	}
+
+	// The handler may have masked the pin itself
+	if (!desc->Masked)
+		msm_gpio_irq_unmask(gpio);
+}
+
+VOID
+EFIAPI
+GpioDebounceArmNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+	EFI_TPL OldTpl;
+	BOOLEAN Pending;
+
+	for (UINTN gpio = 0; gpio < NR_GPIO_IRQS; gpio++) {
+		OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+		Pending = mGpioIrq[gpio].DebouncePending;
+		mGpioIrq[gpio].DebouncePending = FALSE;
+		gBS->RestoreTPL(OldTpl);
+
+		if (Pending)
+			gBS->SetTimer(mGpioIrq[gpio].DebounceEvent, TimerRelative, mGpioIrq[gpio].Debounce);
+	}
 }
 
 VOID
@@ -319,20 +589,154 @@ MsmGpioIsr (
   IN  EFI_SYSTEM_CONTEXT          SystemContext
   )
 {
-	UINTN s, e;
+	UINTN pending, bit, gpio, level;
+	GPIO_IRQ_DESC *desc;
 	gpioregs *r;
 
+	// InterruptDxe raises to TPL_HIGH_LEVEL around us, the events signalled
+	// here are dispatched once it released the summary interrupt.
 	for (UINTN i = 0; i < ARRAY_SIZE(GPIO_REGS); i++) {
 		r = GPIO_REGS + i;
-		s = readl(r->int_status);
-		e = readl(r->int_en);
-		for (int j = 0; j < 32; j++)
-			if (e & s & (1 << j)) {
-				msm_gpio_irq_ack(r->start + j);
+		pending = readl(r->int_status) & readl(r->int_en);
+
+		while (pending) {
+			bit = LowBitSet32(pending);
+			pending &= ~(1 << bit);
+			gpio = r->start + bit;
+			desc = &mGpioIrq[gpio];
+
+			if (desc->Handler == NULL) {
+				writel(1 << bit, r->int_clear);
+				writel(readl(r->int_en) & ~(1 << bit), r->int_en);
+				continue;
+			}
+
+			if (desc->Debounce != 0) {
+				// Sample again once the line has settled
+				writel(readl(r->int_en) & ~(1 << bit), r->int_en);
+				writel(1 << bit, r->int_clear);
+				desc->DebouncePending = TRUE;
+				gBS->SignalEvent(mDebounceArmEvent);
+				continue;
+			}
+
+			level = (readl(r->in) & (1 << bit)) ? 1 : 0;
+
+			if (msm_gpio_irq_is_level(desc))
+				writel(readl(r->int_en) & ~(1 << bit), r->int_en);
+
+			msm_gpio_irq_ack(gpio);
+			desc->LastLevel = level;
+			desc->Handler(gpio, level, desc->Context);
 		}
 	}
-	
-	// Handler part stripped
+}
+
+EFI_STATUS
+GpioIrqRegister (
+  IN TLMM_GPIO_PIN                Gpio,
+  IN TLMM_GPIO_TRIGGER            Trigger,
+  IN UINTN                        DebounceUs,
+  IN TLMM_GPIO_INTERRUPT_HANDLER  Handler,
+  IN VOID                         *Context
+  )
+{
+	GPIO_IRQ_DESC *desc;
+	EFI_STATUS Status;
+	EFI_TPL OldTpl;
+
+	if (Gpio >= NR_GPIO_IRQS || Trigger >= GpioTriggerMax || Handler == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	desc = &mGpioIrq[Gpio];
+	if (desc->Handler != NULL)
+		return EFI_ALREADY_STARTED;
+
+	if (DebounceUs != 0 && desc->DebounceEvent == NULL) {
+		Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY,
+			GpioDebounceTimerNotify, (VOID *)Gpio, &desc->DebounceEvent);
+		if (EFI_ERROR(Status))
+			return Status;
+	}
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+
+	msm_gpio_irq_mask(Gpio);
+	gpio_config(Gpio, GPIO_INPUT);
+
+	desc->Trigger = Trigger;
+	desc->Debounce = MultU64x32(DebounceUs, 10);
+	desc->Context = Context;
+	desc->DebouncePending = FALSE;
+	desc->Masked = FALSE;
+	desc->LastLevel = gpio_get(Gpio);
+	desc->Handler = Handler;
+
+	msm_gpio_irq_set_type(Gpio, Trigger);
+	msm_gpio_irq_unmask(Gpio);
+
+	gBS->RestoreTPL(OldTpl);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS
+GpioIrqUnregister (
+  IN TLMM_GPIO_PIN  Gpio
+  )
+{
+	EFI_TPL OldTpl;
+
+	if (Gpio >= NR_GPIO_IRQS || mGpioIrq[Gpio].Handler == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	msm_gpio_irq_mask(Gpio);
+	msm_gpio_irq_clear(Gpio);
+	mGpioIrq[Gpio].Handler = NULL;
+	mGpioIrq[Gpio].DebouncePending = FALSE;
+	gBS->RestoreTPL(OldTpl);
+
+	if (mGpioIrq[Gpio].DebounceEvent != NULL)
+		gBS->SetTimer(mGpioIrq[Gpio].DebounceEvent, TimerCancel, 0);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS
+GpioIrqMask (
+  IN TLMM_GPIO_PIN  Gpio
+  )
+{
+	EFI_TPL OldTpl;
+
+	if (Gpio >= NR_GPIO_IRQS || mGpioIrq[Gpio].Handler == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	mGpioIrq[Gpio].Masked = TRUE;
+	msm_gpio_irq_mask(Gpio);
+	gBS->RestoreTPL(OldTpl);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS
+GpioIrqUnmask (
+  IN TLMM_GPIO_PIN  Gpio
+  )
+{
+	EFI_TPL OldTpl;
+
+	if (Gpio >= NR_GPIO_IRQS || mGpioIrq[Gpio].Handler == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	mGpioIrq[Gpio].Masked = FALSE;
+	msm_gpio_irq_unmask(Gpio);
+	gBS->RestoreTPL(OldTpl);
+
+	return EFI_SUCCESS;
 }
 
 /**
@@ -341,7 +745,19 @@ MsmGpioIsr (
 TLMM_GPIO  gGpio = {
   gpio_get,
   gpio_set,
-  gpio_config
+  gpio_config,
+  gpio_pin_to_bank,
+  gpio_bank_read,
+  gpio_bank_write,
+  gpio_bank_direction,
+  gpio_tlmm_config_table
+};
+
+TLMM_GPIO_INTERRUPT  gGpioInterrupt = {
+  GpioIrqRegister,
+  GpioIrqUnregister,
+  GpioIrqMask,
+  GpioIrqUnmask
 };
 
 EFI_STATUS
@@ -363,12 +779,17 @@ GpioDxeInitialize(
   Status = gBS->LocateProtocol (&gHardwareInterruptProtocolGuid, NULL, (VOID **)&gInterrupt);
   ASSERT_EFI_ERROR (Status);
 
+  gpio_bank_init();
+
   // Clear
   for (UINTN i = 0; i < ARRAY_SIZE(GPIO_REGS); i++) {
 	MmioWrite32(GPIO_REGS[i].int_clear, -1);
 	MmioWrite32(GPIO_REGS[i].int_en, 0);
   }
 
+  Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_NOTIFY, GpioDebounceArmNotify, NULL, &mDebounceArmEvent);
+  ASSERT_EFI_ERROR (Status);
+
   // Install interrupt handler
   Status = gInterrupt->RegisterInterruptSource(gInterrupt, INT_GPIO_GROUP1, MsmGpioIsr);
   ASSERT_EFI_ERROR (Status);
@@ -380,6 +801,8 @@ GpioDxeInitialize(
                   &Handle,
                   &gTlmmGpioProtocolGuid,
                   &gGpio,
+                  &gTlmmGpioInterruptProtocolGuid,
+                  &gGpioInterrupt,
                   NULL
                   );
   if (EFI_ERROR (Status)) {
@@ -25,9 +25,33 @@
 
 #include <Protocol/Cpu.h>
 #include <Protocol/HardwareInterrupt.h>
+#include <Protocol/HtcLeoInterruptControl.h>
 
 #include <Chipset/interrupts.h>
 #include <Chipset/irqs.h>
+#include <Chipset/timer.h>
+
+#define DGT_TICKS_TO_NS(t)  (((UINT64)(t) * 625) / 3)
+
+// VIC sources followed by the SIRC sources cascaded on INT_SIRC_0/1
+#define NR_HW_IRQS          (NR_MSM_IRQS + NR_SIRC_IRQS)
+#define IS_SIRC_IRQ(irq)    ((irq) >= FIRST_SIRC_IRQ && (irq) < NR_HW_IRQS)
+#define SIRC_MASK           ((1 << NR_SIRC_IRQS) - 1)
+#define SIRC_BIT(irq)       (1 << ((irq) - FIRST_SIRC_IRQ))
+
+// SIRC trigger modes, as the Linux MSM drivers request these sources.
+// The GPIO summary lines stay asserted until the TLMM status is cleared.
+#define SIRC_LEVEL_HIGH     (SIRC_BIT(INT_UART1) | SIRC_BIT(INT_UART2) | \
+                             SIRC_BIT(INT_UART3) |                        \
+                             SIRC_BIT(INT_GPIO_GROUP1) |                  \
+                             SIRC_BIT(INT_GPIO_GROUP2) |                  \
+                             SIRC_BIT(INT_GPIO_GROUP1_SECURE) |           \
+                             SIRC_BIT(INT_GPIO_GROUP2_SECURE))
+// UART RX wake-up lines fire on the start bit
+#define SIRC_EDGE_FALLING   (SIRC_BIT(INT_UART1_RX) | SIRC_BIT(INT_UART2_RX) | \
+                             SIRC_BIT(INT_UART3_RX))
+// Everything else is a rising edge
+#define SIRC_EDGE           (SIRC_MASK & ~SIRC_LEVEL_HIGH)
 
 //
 // Notifications
@@ -35,9 +59,34 @@
 EFI_EVENT EfiExitBootServicesEvent      = (EFI_EVENT)NULL;
 
 HARDWARE_INTERRUPT_HANDLER  gRegisteredInterruptHandlers[NR_IRQS];
+BOOLEAN                     gInterruptNesting[NR_HW_IRQS];
+HTCLEO_INTERRUPT_STATS      gInterruptStats[NR_HW_IRQS];
+
+// Vectors read from VIC_IRQ_VEC_RD, innermost last. Only higher priorities
+// preempt, one level per priority, handlers that released their vector
+// early may be preempted by anything once more.
+#define VIC_MAX_IN_SERVICE  (2 * (VIC_PRIORITY_LOWEST + 1))
+#define VIC_VECTOR_RELEASED MAX_UINT32
+STATIC UINT32               mInService[VIC_MAX_IN_SERVICE];
+STATIC UINTN                mInServiceDepth;
+
+// Timer ticks, and those of them that woke the CPU from WFI
+UINT64                      gTimerTicks;
+UINT64                      gTimerIdleTicks;
+
+// TimerLib delays of every DXE module
+HTCLEO_DELAY_STATS          gDelayStats;
+
+#define ARM_WFI_MASK        0x0FFFFFFF
+#define ARM_WFI             0x0320F003
+#define ARM_CP15_WFI        0x0E070F90    // mcr p15, 0, rX, c7, c0, 4
+#define THUMB_WFI           0xBF30
+#define CPSR_THUMB          BIT5
 
 VOID InitInterrupts(VOID)
 {
+	UINTN Index;
+
 	MmioWrite32(VIC_INT_CLEAR0, 0xffffffff);
 	MmioWrite32(VIC_INT_CLEAR1, 0xffffffff);
 	MmioWrite32(VIC_INT_SELECT0, 0);
@@ -45,13 +94,31 @@ VOID InitInterrupts(VOID)
 	MmioWrite32(VIC_INT_TYPE0, 0xffffffff);
 	MmioWrite32(VIC_INT_TYPE1, 0xffffffff);
 	MmioWrite32(VIC_CONFIG, 0);
+
+	// Everything at the lowest priority except the UEFI tick
+	for (Index = 0; Index < NR_MSM_IRQS; Index++)
+		MmioWrite32(VIC_VECTPRIORITY(Index), VIC_PRIORITY_LOWEST);
+	MmioWrite32(VIC_VECTPRIORITY(INT_DEBUG_TIMER_EXP), VIC_PRIORITY_HIGHEST);
+
+	// All SIRC sources are routed to INT_SIRC_0, they are masked
+	// individually on the SIRC so the cascade stays on.
+	MmioWrite32(SIRC_INT_ENCLEAR, SIRC_MASK);
+	MmioWrite32(SIRC_INT_SELECT, 0);
+	MmioWrite32(SIRC_INT_TYPE, SIRC_EDGE);
+	MmioWrite32(SIRC_INT_POLARITY, SIRC_EDGE_FALLING);
+	MmioWrite32(SIRC_INT_CLEAR, SIRC_MASK);
+
 	MmioWrite32(VIC_INT_EN0, 1);
 	MmioWrite32(VIC_INT_EN1, 1);
+	MmioWrite32(VIC_INT_ENSET0, MSM_IRQ_BIT(INT_SIRC_0));
+	MmioWrite32(VIC_INT_ENSET1, MSM_IRQ_BIT(INT_SIRC_1));
 	MmioWrite32(VIC_INT_MASTEREN, 1);
 }
 
 VOID DeinitInterupts(VOID)
 {
+	MmioWrite32(SIRC_INT_ENCLEAR, SIRC_MASK);
+	MmioWrite32(SIRC_INT_CLEAR, SIRC_MASK);
 	MmioWrite32(VIC_INT_MASTEREN, 0);
 	MmioWrite32(VIC_INT_EN0, 0);
 	MmioWrite32(VIC_INT_EN1, 0);
@@ -85,7 +152,7 @@ RegisterInterruptSource (
   IN HARDWARE_INTERRUPT_HANDLER         Handler
   )
 {
-  if (Source > NR_IRQS) {
+  if (Source >= NR_HW_IRQS) {
     ASSERT(FALSE);
     return EFI_UNSUPPORTED;
   }
@@ -123,10 +190,15 @@ EnableInterruptSource (
   IN HARDWARE_INTERRUPT_SOURCE          Source
   )
 {
-  if (Source > NR_IRQS) {
+  if (Source >= NR_HW_IRQS) {
     ASSERT(FALSE);
     return EFI_UNSUPPORTED;
   }
+
+  if (IS_SIRC_IRQ(Source)) {
+    MmioWrite32(SIRC_INT_ENSET, 1 << (Source - FIRST_SIRC_IRQ));
+    return EFI_SUCCESS;
+  }
   
   /* unmask interrupt */
   unsigned reg = (Source > 31) ? VIC_INT_ENSET1 : VIC_INT_ENSET0;
@@ -154,11 +226,16 @@ DisableInterruptSource (
   IN HARDWARE_INTERRUPT_SOURCE          Source
   )
 {
-  if (Source > NR_IRQS) {
+  if (Source >= NR_HW_IRQS) {
     ASSERT(FALSE);
     return EFI_UNSUPPORTED;
   }
 
+  if (IS_SIRC_IRQ(Source)) {
+    MmioWrite32(SIRC_INT_ENCLEAR, 1 << (Source - FIRST_SIRC_IRQ));
+    return EFI_SUCCESS;
+  }
+
   /* mask_interrupt */
   unsigned reg = (Source > 31) ? VIC_INT_ENCLEAR1 : VIC_INT_ENCLEAR0;
 	unsigned bit = 1 << (Source & 31);
@@ -186,7 +263,7 @@ ExitBootServicesEvent (
   UINTN Index;
 
   // Mask all interrupts
-  for (Index = 0; Index < NR_IRQS; Index++) {
+  for (Index = 0; Index < NR_HW_IRQS; Index++) {
     DisableInterruptSource(NULL, Index);
   }
   // Disable all interrupts
@@ -215,11 +292,17 @@ GetInterruptSourceState (
 {
   UINTN Bit;
 
-  if (Source > NR_IRQS) {
+  if (Source >= NR_HW_IRQS) {
     ASSERT(FALSE);
     return EFI_UNSUPPORTED;
   }
 
+  if (IS_SIRC_IRQ(Source)) {
+    Bit = 1 << (Source - FIRST_SIRC_IRQ);
+    *InterruptState = (MmioRead32(SIRC_INT_ENABLE) & Bit) != 0;
+    return EFI_SUCCESS;
+  }
+
 	Bit = 1 << (Source & 31);
 
   if ((MmioRead32((Source > 31) ? VIC_INT_ENCLEAR1 : VIC_INT_ENCLEAR0) & Bit) == Bit) {
@@ -232,6 +315,27 @@ GetInterruptSourceState (
   return EFI_SUCCESS;
 }
 
+/**
+  Pops the innermost vector off the VIC in-service stack, unless its
+  handler already did so through EndOfInterrupt. Called with the CPU
+  IRQ masked.
+
+**/
+STATIC
+VOID
+InterruptRelease (
+  VOID
+  )
+{
+  ASSERT (mInServiceDepth != 0);
+
+  if (mInService[mInServiceDepth - 1] != VIC_VECTOR_RELEASED) {
+    mInService[mInServiceDepth - 1] = VIC_VECTOR_RELEASED;
+    MmioWrite32(VIC_IRQ_VEC_WR, 0);
+    ArmDataSynchronizationBarrier ();
+  }
+}
+
 /**
   Signal to the hardware that the End Of Intrrupt state 
   has been reached.
@@ -250,18 +354,181 @@ EndOfInterrupt (
   IN HARDWARE_INTERRUPT_SOURCE          Source
   )
 {
-  if (Source > NR_IRQS) {
+  BOOLEAN InterruptsEnabled;
+
+  if (Source >= NR_HW_IRQS) {
     ASSERT(FALSE);
     return EFI_UNSUPPORTED;
   }
 
-  MmioWrite32(VIC_IRQ_VEC_WR, 0);
-  ArmDataSynchronizationBarrier ();
+  // SIRC sources are acknowledged before dispatch, the VIC vector
+  // belongs to the cascade and is released by IrqInterruptHandler.
+  if (IS_SIRC_IRQ(Source)) {
+    return EFI_SUCCESS;
+  }
+
+  InterruptsEnabled = SaveAndDisableInterrupts ();
+  // Only the vector in service may be popped, and only once. Anything
+  // else would release the priority level of an interrupted handler.
+  if (mInServiceDepth != 0 && mInService[mInServiceDepth - 1] == Source) {
+    InterruptRelease ();
+  }
+  SetInterruptState (InterruptsEnabled);
 
   return EFI_SUCCESS;
 }
 
 
+/**
+  Timestamp for the handler statistics.
+
+  The DGT runs at 4.8 MHz and is cleared on match by TimerDxe, so the
+  distance between two samples has to account for one period wrap.
+  Handlers running longer than a timer period are under-reported.
+
+**/
+STATIC
+UINT32
+InterruptTimestamp (
+  VOID
+  )
+{
+  return MmioRead32(DGT_COUNT_VAL);
+}
+
+STATIC
+UINT32
+InterruptTicksBetween (
+  IN UINT32 Start,
+  IN UINT32 End
+  )
+{
+  if (End >= Start) {
+    return End - Start;
+  }
+
+  return End + MmioRead32(DGT_MATCH_VAL) + 1 - Start;
+}
+
+STATIC
+VOID
+InterruptRecordStats (
+  IN UINT32   Vector,
+  IN UINT32   Start,
+  IN UINT32   End
+  )
+{
+  HTCLEO_INTERRUPT_STATS *Stats = &gInterruptStats[Vector];
+  UINT32                 TimeNs;
+  UINT32                 LatencyNs;
+
+  TimeNs = (UINT32)DGT_TICKS_TO_NS(InterruptTicksBetween(Start, End));
+
+  Stats->Count++;
+  Stats->TotalTimeNs += TimeNs;
+  if (TimeNs > Stats->MaxTimeNs) {
+    Stats->MaxTimeNs = TimeNs;
+  }
+
+  // The DGT counts up from zero since its own match, that is the entry latency
+  if (Vector == INT_DEBUG_TIMER_EXP) {
+    LatencyNs = (UINT32)DGT_TICKS_TO_NS(Start);
+    Stats->LatencySamples++;
+    Stats->TotalLatencyNs += LatencyNs;
+    if (LatencyNs > Stats->MaxLatencyNs) {
+      Stats->MaxLatencyNs = LatencyNs;
+    }
+  }
+}
+
+/**
+  Checks whether an interrupt hit the CPU sleeping in WFI.
+
+  The saved PC is where execution resumes, so the instruction before it
+  is the one that was interrupted. Sampled on the periodic timer tick
+  this gives the idle ratio without hooking the idle loop itself.
+
+**/
+STATIC
+BOOLEAN
+InterruptedWfi (
+  IN EFI_SYSTEM_CONTEXT   SystemContext
+  )
+{
+  UINT32 Pc = SystemContext.SystemContextArm->PC;
+  UINT32 Insn;
+
+  if ((SystemContext.SystemContextArm->CPSR & CPSR_THUMB) != 0) {
+    return *(CONST UINT16 *)(UINTN)(Pc - 2) == THUMB_WFI;
+  }
+
+  Insn = *(CONST UINT32 *)(UINTN)(Pc - 4) & ARM_WFI_MASK;
+  return Insn == ARM_WFI || (Insn & ~0xF000) == ARM_CP15_WFI;
+}
+
+STATIC
+VOID
+InterruptDispatch (
+  IN UINT32               Source,
+  IN EFI_SYSTEM_CONTEXT   SystemContext
+  )
+{
+  HARDWARE_INTERRUPT_HANDLER InterruptHandler;
+
+  InterruptHandler = gRegisteredInterruptHandlers[Source];
+  if (InterruptHandler == NULL) {
+    return;
+  }
+
+  // Call the registered interrupt handler.
+  InterruptHandler (Source, SystemContext);
+}
+
+/**
+  Demultiplex a SIRC cascade input.
+
+  Every pending and enabled SIRC source is cleared and dispatched as
+  FIRST_SIRC_IRQ + bit. The status is re-read until it drains so edges
+  arriving while a handler runs are not lost behind the cascade vector.
+  Edges are cleared before the handler runs so a new one is latched,
+  level sources after it, once the handler has removed the cause.
+
+  @param StatusReg      SIRC_IRQ0_STATUS or SIRC_IRQ1_STATUS
+  @param SystemContext  Context passed through to the handlers
+
+**/
+STATIC
+VOID
+SircInterruptHandler (
+  IN UINTN                StatusReg,
+  IN EFI_SYSTEM_CONTEXT   SystemContext
+  )
+{
+  UINT32 Status;
+  UINT32 Bit;
+  UINT32 Source;
+  UINT32 Start;
+
+  while ((Status = MmioRead32(StatusReg) & SIRC_MASK) != 0) {
+    Bit = LowBitSet32 (Status);
+    Source = FIRST_SIRC_IRQ + Bit;
+
+    Start = InterruptTimestamp ();
+    if ((SIRC_EDGE & (1 << Bit)) != 0) {
+      MmioWrite32(SIRC_INT_CLEAR, 1 << Bit);
+      ArmDataSynchronizationBarrier ();
+    }
+
+    InterruptDispatch (Source, SystemContext);
+
+    if ((SIRC_EDGE & (1 << Bit)) == 0) {
+      MmioWrite32(SIRC_INT_CLEAR, 1 << Bit);
+      ArmDataSynchronizationBarrier ();
+    }
+    InterruptRecordStats (Source, Start, InterruptTimestamp ());
+  }
+}
+
 /**
   EFI_CPU_INTERRUPT_HANDLER that is called when a processor interrupt occurs.
 
@@ -281,23 +548,182 @@ IrqInterruptHandler (
   )
 {
   UINT32                     Vector;
-  HARDWARE_INTERRUPT_HANDLER InterruptHandler;
+  UINT32                     Start;
+  BOOLEAN                    Nesting;
+  EFI_TPL                    OldTpl;
   
+  // Reading the vector pushes it on the VIC in-service stack, only sources
+  // of a higher priority are forwarded until VIC_IRQ_VEC_WR pops it again.
   Vector = MmioRead32 (VIC_IRQ_VEC_RD);
+  Start = InterruptTimestamp ();
+
+  if (Vector >= NR_MSM_IRQS) {
+    MmioWrite32(VIC_IRQ_VEC_WR, 0);
+    ArmDataSynchronizationBarrier ();
+    return;
+  }
+
+  ASSERT (mInServiceDepth < VIC_MAX_IN_SERVICE);
+  mInService[mInServiceDepth++] = Vector;
+
   MmioWrite32((Vector > 31) ? VIC_INT_CLEAR1 : VIC_INT_CLEAR0, 1 << (Vector & 31));
 
+  if (Vector == INT_DEBUG_TIMER_EXP) {
+    gTimerTicks++;
+    if (InterruptedWfi (SystemContext)) {
+      gTimerIdleTicks++;
+    }
+  }
+
   // Needed to prevent infinite nesting when Time Driver lowers TPL
   ArmDataSynchronizationBarrier ();
+
+  // Handlers run at TPL_HIGH_LEVEL, events they signal are dispatched
+  // only once their vector is released below. Nesting handlers run at
+  // TPL_NOTIFY with the CPU IRQ open instead, a tick preempting them
+  // then only dispatches what is above TPL_NOTIFY.
+  Nesting = gInterruptNesting[Vector];
+  OldTpl = gBS->RaiseTPL (Nesting ? TPL_NOTIFY : TPL_HIGH_LEVEL);
+  if (Nesting) {
+    ArmEnableInterrupts ();
+  }
   
-  InterruptHandler = gRegisteredInterruptHandlers[Vector];
-  if (InterruptHandler != NULL) {
-    // Call the registered interrupt handler.
-    InterruptHandler (Vector, SystemContext);
+  if (Vector == INT_SIRC_0) {
+    SircInterruptHandler (SIRC_IRQ0_STATUS, SystemContext);
+  } else if (Vector == INT_SIRC_1) {
+    SircInterruptHandler (SIRC_IRQ1_STATUS, SystemContext);
+  } else {
+    InterruptDispatch (Vector, SystemContext);
+  }
+
+  ArmDisableInterrupts ();
+
+  InterruptRecordStats (Vector, Start, InterruptTimestamp ());
+
+  // Clear after running the handler, unless EndOfInterrupt already did
+  InterruptRelease ();
+  mInServiceDepth--;
+
+  // Notifications signalled by the handler run here, other sources can
+  // preempt them. The exception return restores the CPU IRQ state.
+  gBS->RestoreTPL (OldTpl);
+}
+
+EFI_STATUS
+InterruptSetPriority (
+  IN UINTN    Source,
+  IN UINTN    Priority
+  )
+{
+  if (Source >= NR_MSM_IRQS || Priority > VIC_PRIORITY_LOWEST) {
+    return EFI_INVALID_PARAMETER;
   }
 
-  // Clear after running the handler
-  MmioWrite32(VIC_IRQ_VEC_WR, 0);
+  MmioWrite32(VIC_VECTPRIORITY(Source), Priority);
   ArmDataSynchronizationBarrier ();
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+InterruptSetNesting (
+  IN UINTN    Source,
+  IN BOOLEAN  Enable
+  )
+{
+  // SIRC handlers run inside the cascade loop, its vector can't be
+  // popped before the loop drains
+  if (Source >= NR_MSM_IRQS) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  gInterruptNesting[Source] = Enable;
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+InterruptGetStats (
+  IN  UINTN                   Source,
+  OUT HTCLEO_INTERRUPT_STATS  *Stats
+  )
+{
+  EFI_TPL OldTpl;
+
+  if (Source >= NR_HW_IRQS || Stats == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  CopyMem (Stats, &gInterruptStats[Source], sizeof (*Stats));
+  gBS->RestoreTPL (OldTpl);
+
+  return EFI_SUCCESS;
+}
+
+VOID
+InterruptResetStats (
+  VOID
+  )
+{
+  EFI_TPL OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  ZeroMem (gInterruptStats, sizeof (gInterruptStats));
+  ZeroMem (&gDelayStats, sizeof (gDelayStats));
+  gBS->RestoreTPL (OldTpl);
+}
+
+VOID
+InterruptGetIdleStats (
+  OUT UINT64  *IdleTicks,
+  OUT UINT64  *Ticks
+  )
+{
+  EFI_TPL OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  *IdleTicks = gTimerIdleTicks;
+  *Ticks = gTimerTicks;
+  gBS->RestoreTPL (OldTpl);
+}
+
+VOID
+InterruptRecordDelay (
+  IN UINTN    MicroSeconds,
+  IN UINT32   SleptUs,
+  IN VOID     *Caller
+  )
+{
+  BOOLEAN InterruptsEnabled;
+
+  // Delays are made at any TPL, including from interrupt handlers
+  InterruptsEnabled = SaveAndDisableInterrupts ();
+
+  gDelayStats.Calls++;
+  gDelayStats.TotalUs += MicroSeconds;
+  if (SleptUs != 0) {
+    gDelayStats.SleepCalls++;
+    gDelayStats.SleptUs += SleptUs;
+  }
+  if (MicroSeconds > gDelayStats.MaxUs) {
+    gDelayStats.MaxUs = (UINT32)MicroSeconds;
+    gDelayStats.MaxCaller = Caller;
+  }
+
+  SetInterruptState (InterruptsEnabled);
+}
+
+VOID
+InterruptGetDelayStats (
+  OUT HTCLEO_DELAY_STATS  *Stats
+  )
+{
+  EFI_TPL OldTpl;
+
+  OldTpl = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  CopyMem (Stats, &gDelayStats, sizeof (*Stats));
+  gBS->RestoreTPL (OldTpl);
 }
 
 //
@@ -316,6 +742,17 @@ EFI_HARDWARE_INTERRUPT_PROTOCOL gHardwareInterruptProtocol = {
   EndOfInterrupt
 };
 
+HTCLEO_INTERRUPT_CONTROL_PROTOCOL gInterruptControlProtocol = {
+  NR_HW_IRQS,
+  InterruptSetPriority,
+  InterruptSetNesting,
+  InterruptGetStats,
+  InterruptResetStats,
+  InterruptGetIdleStats,
+  InterruptRecordDelay,
+  InterruptGetDelayStats
+};
+
 /**
   Initialize the state information for the CPU Architectural Protocol
 
@@ -341,6 +778,7 @@ InterruptDxeInitialize (
  
   Status = gBS->InstallMultipleProtocolInterfaces(&gHardwareInterruptHandle,
                                                   &gHardwareInterruptProtocolGuid,   &gHardwareInterruptProtocol,
+                                                  &gHtcLeoInterruptControlProtocolGuid, &gInterruptControlProtocol,
                                                   NULL);
   ASSERT_EFI_ERROR(Status);
   
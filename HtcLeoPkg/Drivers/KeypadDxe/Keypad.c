@@ -278,6 +278,17 @@ KeypadControllerDriverStart(
     goto ErrorExit;
   }
 
+  //
+  // Signalled by interrupt capable devices to restart the polling timer
+  //
+  Status = gBS->CreateEvent(
+      EVT_NOTIFY_SIGNAL, TPL_CALLBACK, KeypadWakeHandler, ConsoleIn,
+      &ConsoleIn->WakeEvent);
+  if (EFI_ERROR(Status)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto ErrorExit;
+  }
+
   Status = gBS->CreateEvent(
       EVT_NOTIFY_SIGNAL, TPL_CALLBACK, KeyNotifyProcessHandler, ConsoleIn,
       &ConsoleIn->KeyNotifyProcessEvent);
@@ -323,6 +334,9 @@ ErrorExit:
   if ((ConsoleIn != NULL) && (ConsoleIn->TimerEvent != NULL)) {
     gBS->CloseEvent(ConsoleIn->TimerEvent);
   }
+  if ((ConsoleIn != NULL) && (ConsoleIn->WakeEvent != NULL)) {
+    gBS->CloseEvent(ConsoleIn->WakeEvent);
+  }
   if ((ConsoleIn != NULL) && (ConsoleIn->ConInEx.WaitForKeyEx != NULL)) {
     gBS->CloseEvent(ConsoleIn->ConInEx.WaitForKeyEx);
   }
@@ -392,6 +406,11 @@ KeypadControllerDriverStop(
     ConsoleIn->TimerEvent = NULL;
   }
 
+  if (ConsoleIn->WakeEvent != NULL) {
+    gBS->CloseEvent(ConsoleIn->WakeEvent);
+    ConsoleIn->WakeEvent = NULL;
+  }
+
   //
   // Uninstall the SimpleTextIn and SimpleTextInEx protocols
   //
@@ -68,6 +68,7 @@ typedef struct {
   EFI_SIMPLE_TEXT_INPUT_EX_PROTOCOL ConInEx;
 
   EFI_EVENT TimerEvent;
+  EFI_EVENT WakeEvent;
 
   KEYPAD_DEVICE_PROTOCOL *KeypadDevice;
   KEYPAD_RETURN_API       KeypadReturnApi;
@@ -181,6 +182,16 @@ InitKeypad(
 **/
 VOID EFIAPI KeypadTimerHandler(IN EFI_EVENT Event, IN VOID *Context);
 
+/**
+  Wake event handler: the keypad device saw key activity while the
+  polling timer was stopped. Restarts polling and scans right away.
+
+  @param Event       The wake event
+  @param Context     A KEYPAD_CONSOLE_IN_DEV pointer
+
+**/
+VOID EFIAPI KeypadWakeHandler(IN EFI_EVENT Event, IN VOID *Context);
+
 /**
   logic reset keypad
   Implement SIMPLE_TEXT_IN.Reset()
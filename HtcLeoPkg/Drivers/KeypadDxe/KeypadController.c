@@ -66,12 +66,41 @@ VOID EFIAPI KeypadTimerHandler(IN EFI_EVENT Event, IN VOID *Context)
       ConsoleIn->KeypadDevice, &ConsoleIn->KeypadReturnApi,
       GetTimeInNanoSecond(DeltaCounter));
 
+  //
+  // Stop polling once the device can wake us up on the next key
+  //
+  if (ConsoleIn->KeypadDevice->Arm != NULL &&
+      !EFI_ERROR(ConsoleIn->KeypadDevice->Arm(
+          ConsoleIn->KeypadDevice, ConsoleIn->WakeEvent))) {
+    gBS->SetTimer(ConsoleIn->TimerEvent, TimerCancel, 0);
+  }
+
   //
   // Leave critical section and return
   //
   gBS->RestoreTPL(OldTpl);
 }
 
+/**
+  Wake event handler: the keypad device saw key activity while the
+  polling timer was stopped. Restarts polling and scans right away.
+
+  @param Event       The wake event
+  @param Context     A KEYPAD_CONSOLE_IN_DEV pointer
+
+**/
+VOID EFIAPI KeypadWakeHandler(IN EFI_EVENT Event, IN VOID *Context)
+{
+  KEYPAD_CONSOLE_IN_DEV *ConsoleIn;
+
+  ConsoleIn = (KEYPAD_CONSOLE_IN_DEV *)Context;
+
+  ConsoleIn->Last = GetPerformanceCounter();
+  gBS->SetTimer(ConsoleIn->TimerEvent, TimerPeriodic, KEYPAD_TIMER_INTERVAL);
+
+  KeypadTimerHandler(NULL, ConsoleIn);
+}
+
 /**
   Perform 8042 controller and keypad Initialization.
   If ExtendedVerification is TRUE, do additional test for
@@ -1,6 +1,6 @@
 /*
  * Copyright (c) 2012, Shantanu Gupta <shans95g@gmail.com>
- * Based on the open source driver from HTC, Interrupts are not supported yet
+ * Based on the open source driver from HTC
  */
 #include <Uefi.h>
 
@@ -17,6 +17,8 @@
 #include <Chipset/timer.h>
 
 #include <Device/microp.h>
+#include <Device/Gpio.h>
+#include <Protocol/GpioTlmmInterrupt.h>
 #include <Protocol/HtcLeoMicroP.h>
 #include <Protocol/HtcLeoI2C.h>
 
@@ -32,8 +34,192 @@ static struct microp_platform_data microp_pdata = {
 
 static struct microp_platform_data *pdata = NULL;
 
+/*
+ * Shadow copies of the command registers that just hold state, writing
+ * the value they already have is suppressed. Trigger style commands
+ * (ADC requests, interrupt clears, ...) are never cached.
+ */
+#define MICROP_SHADOW_MAX_LEN 4
+
+struct microp_shadow {
+	uint8_t addr;
+	bool valid;		// data matches the MicroP
+	uint8_t len;
+	uint8_t data[MICROP_SHADOW_MAX_LEN];
+};
+
+static struct microp_shadow microp_shadow[] = {
+	{ .addr = MICROP_I2C_WCMD_LCM_BL_MANU_CTL },
+	{ .addr = MICROP_I2C_WCMD_AUTO_BL_CTL },
+	{ .addr = MICROP_I2C_WCMD_LED_PWM },
+	{ .addr = MICROP_I2C_WCMD_BL_EN },
+	{ .addr = MICROP_I2C_WCMD_LED_CTRL },
+	{ .addr = MICROP_I2C_WCMD_LED_MODE },
+	{ .addr = MICROP_I2C_WCMD_JOGBALL_LED_MODE },
+};
+
+/* GPO outputs and GPI interrupt enables, set/cleared through EN/DIS pairs */
+struct microp_mask_shadow {
+	uint16_t known;		// bits whose state we know
+	uint16_t state;
+};
+
+static struct microp_mask_shadow microp_gpo;
+static struct microp_mask_shadow microp_int;
+
+/*
+ * Writes between microp_batch_begin() and microp_batch_end() are queued in
+ * call order and sent as a single I2C transaction, one message per write.
+ * Reads and a full queue flush it early, the MicroP always sees the
+ * commands in the order they were issued.
+ */
+#define MICROP_I2C_WRITE_BLOCK_SIZE 21
+#define MICROP_BATCH_MAX 8
+
+struct microp_write {
+	uint8_t len;		// command byte included
+	uint8_t buf[MICROP_I2C_WRITE_BLOCK_SIZE];
+};
+
+static struct microp_write microp_queue[MICROP_BATCH_MAX];
+static int microp_queued;
+// Nesting depth of microp_batch_begin()
+static int microp_batch;
+// Callers inside the bus code or holding a batch open, the GPI worker
+// may have preempted one of them and backs off
+static int microp_busy;
+
+static int microp_i2c_write_raw(uint8_t addr, uint8_t *cmd, int length);
+
+static struct microp_shadow *microp_shadow_find(uint8_t addr)
+{
+	for (UINTN i = 0; i < ARRAY_SIZE(microp_shadow); i++) {
+		if (microp_shadow[i].addr == addr)
+			return &microp_shadow[i];
+	}
+	return NULL;
+}
+
+/* Forget everything we think we know, the MicroP was (re)probed or reset */
+static void microp_shadow_invalidate(void)
+{
+	for (UINTN i = 0; i < ARRAY_SIZE(microp_shadow); i++)
+		microp_shadow[i].valid = false;
+	SetMem(&microp_gpo, sizeof(microp_gpo), 0);
+	SetMem(&microp_int, sizeof(microp_int), 0);
+}
+
+static int microp_mask_write(uint8_t cmd, uint16_t mask)
+{
+	uint8_t data[2];
+
+	data[0] = mask >> 8;
+	data[1] = mask & 0xFF;
+	return microp_i2c_write_raw(cmd, data, 2);
+}
+
+/*
+ * Sets (enable) or clears bits of a mask register, only bits that change
+ * or whose state is not known yet are sent.
+ */
+static int microp_mask_update(struct microp_mask_shadow *s, uint8_t en_cmd, uint8_t dis_cmd, uint16_t mask, bool enable)
+{
+	uint16_t change = mask & ~s->known;
+
+	if (enable)
+		change |= mask & ~s->state;
+	else
+		change |= mask & s->state;
+
+	if (!change)
+		return 0;
+
+	if (microp_mask_write(enable ? en_cmd : dis_cmd, change) < 0)
+		return -1;
+
+	if (enable)
+		s->state |= change;
+	else
+		s->state &= ~change;
+	s->known |= change;
+
+	return 0;
+}
+
+/*
+ * A MicroP that stops answering may come back from a reset with all its
+ * registers at their defaults, so a transfer that keeps failing drops
+ * the whole shadow.
+ */
+static int microp_i2c_xfer(struct i2c_msg *msgs, int num)
+{
+	int retry;
+
+	for (retry = 0; retry <= MSM_I2C_READ_RETRY_TIMES; retry++) {
+		if (gI2C->Xfer(msgs, num) == num)
+			return 0;
+		MicroSecondDelay(5);
+	}
+
+	microp_shadow_invalidate();
+	return -1;
+}
+
+/*
+ * Sends the queued writes in one burst. Messages in tail, e.g. a read,
+ * join the same transaction behind them.
+ */
+#define MICROP_TAIL_MAX 3
+
+static int microp_flush_with(struct i2c_msg *tail, int tail_num)
+{
+	struct i2c_msg msgs[MICROP_BATCH_MAX + MICROP_TAIL_MAX];
+	int i, num = microp_queued;
+
+	ASSERT(tail_num <= MICROP_TAIL_MAX);
+	if (!num && !tail_num)
+		return 0;
+	microp_queued = 0;
+
+	for (i = 0; i < num; i++) {
+		msgs[i].addr = pdata->chip;
+		msgs[i].flags = 0;
+		msgs[i].len = microp_queue[i].len;
+		msgs[i].buf = microp_queue[i].buf;
+	}
+	if (tail_num)
+		memcpy(&msgs[num], tail, tail_num * sizeof(*tail));
+
+	return microp_i2c_xfer(msgs, num + tail_num);
+}
+
+static int microp_flush(void)
+{
+	return microp_flush_with(NULL, 0);
+}
+
+void microp_batch_begin(void)
+{
+	microp_busy++;
+	microp_batch++;
+}
+
+int microp_batch_end(void)
+{
+	int ret = 0;
+
+	ASSERT(microp_batch > 0);
+	if (--microp_batch == 0)
+		ret = microp_flush();
+	microp_busy--;
+
+	return ret;
+}
+
 int microp_i2c_read(uint8_t addr, uint8_t *data, int length)
 {
+	int ret;
+
 	if (!pdata)
 		return -1;
 		
@@ -42,45 +228,58 @@ int microp_i2c_read(uint8_t addr, uint8_t *data, int length)
 		{.addr = pdata->chip,	.flags = I2C_M_RD,	.len = length,	.buf = data, },
 	};
 	
-	int retry;
-	for (retry = 0; retry <= MSM_I2C_READ_RETRY_TIMES; retry++) {
-		if (gI2C->Xfer(msgs, 2) == 2)
-			break;
-		MicroSecondDelay(5);
-	}
-	if (retry > MSM_I2C_WRITE_RETRY_TIMES)
-		return -1;
-	
-	return 0;
+	// Writes queued in front of it go out first, in the same transaction
+	microp_busy++;
+	ret = microp_flush_with(msgs, 2);
+	microp_busy--;
+
+	return ret;
 }
 
-#define MICROP_I2C_WRITE_BLOCK_SIZE 21
-int microp_i2c_write(uint8_t addr, uint8_t *cmd, int length)
+static int microp_i2c_write_raw(uint8_t addr, uint8_t *cmd, int length)
 {
+	struct microp_write *w;
+	int ret = 0;
+
 	if (!pdata)
 		return -1;
 	if (length >= MICROP_I2C_WRITE_BLOCK_SIZE)
 		return -1;
-	
-	uint8_t cmd_buffer[MICROP_I2C_WRITE_BLOCK_SIZE];
-	
-	struct i2c_msg msg[] = {
-		{.addr = pdata->chip,	.flags = 0,		.len = length + 1,	.buf = cmd_buffer,}
-	};
-	
-	cmd_buffer[0] = addr;
-	memcpy((void *)&cmd_buffer[1], (void *)cmd, length);
-	
-	int retry;
-	for (retry = 0; retry <= MSM_I2C_WRITE_RETRY_TIMES; retry++) {
-		if (gI2C->Xfer(msg, 1) == 1)
-			break;
-		MicroSecondDelay(5);
+
+	microp_busy++;
+	if (microp_queued == MICROP_BATCH_MAX)
+		ret = microp_flush();
+
+	if (ret == 0) {
+		w = &microp_queue[microp_queued++];
+		w->buf[0] = addr;
+		memcpy((void *)&w->buf[1], (void *)cmd, length);
+		w->len = length + 1;
+
+		if (!microp_batch)
+			ret = microp_flush();
 	}
-	if (retry > MSM_I2C_WRITE_RETRY_TIMES)
-		return -1;
-	
-	return 0;
+	microp_busy--;
+
+	return ret;
+}
+
+int microp_i2c_write(uint8_t addr, uint8_t *cmd, int length)
+{
+	struct microp_shadow *s = microp_shadow_find(addr);
+
+	if (!s || length > MICROP_SHADOW_MAX_LEN)
+		return microp_i2c_write_raw(addr, cmd, length);
+
+	if (s->valid && s->len == length && !memcmp(s->data, cmd, length))
+		return 0;
+
+	s->len = length;
+	memcpy(s->data, cmd, length);
+	s->valid = true;
+
+	// A failed transfer already dropped the shadow
+	return microp_i2c_write_raw(addr, cmd, length);
 }
 
 int microp_read_adc(uint8_t channel, uint16_t *value)
@@ -137,12 +336,9 @@ int microp_interrupt_get_status(uint16_t *interrupt_mask)
 
 int microp_interrupt_enable( uint16_t interrupt_mask)
 {
-	uint8_t data[2];
 	int ret = -1;
 
-	data[0] = interrupt_mask >> 8;
-	data[1] = interrupt_mask & 0xFF;
-	ret = microp_i2c_write(MICROP_I2C_WCMD_GPI_INT_CTL_EN, data, 2);
+	ret = microp_mask_update(&microp_int, MICROP_I2C_WCMD_GPI_INT_CTL_EN, MICROP_I2C_WCMD_GPI_INT_CTL_DIS, interrupt_mask, true);
 
 	if (ret < 0)
 		DEBUG((EFI_D_ERROR, "%s: enable 0x%x interrupt failed\n", __func__, interrupt_mask));//INFO
@@ -151,12 +347,9 @@ int microp_interrupt_enable( uint16_t interrupt_mask)
 
 int microp_interrupt_disable(uint16_t interrupt_mask)
 {
-	uint8_t data[2];
 	int ret = -1;
 
-	data[0] = interrupt_mask >> 8;
-	data[1] = interrupt_mask & 0xFF;
-	ret = microp_i2c_write(MICROP_I2C_WCMD_GPI_INT_CTL_DIS, data, 2);
+	ret = microp_mask_update(&microp_int, MICROP_I2C_WCMD_GPI_INT_CTL_EN, MICROP_I2C_WCMD_GPI_INT_CTL_DIS, interrupt_mask, false);
 
 	if (ret < 0)
 		DEBUG((EFI_D_ERROR, "%s: disable 0x%x interrupt failed\n", __func__, interrupt_mask));//INFO
@@ -180,12 +373,9 @@ int microp_read_gpo_status(uint16_t *status)
 
 int microp_gpo_enable(uint16_t gpo_mask)
 {
-	uint8_t data[2];
 	int ret = -1;
 
-	data[0] = gpo_mask >> 8;
-	data[1] = gpo_mask & 0xFF;
-	ret = microp_i2c_write(MICROP_I2C_WCMD_GPO_LED_STATUS_EN, data, 2);
+	ret = microp_mask_update(&microp_gpo, MICROP_I2C_WCMD_GPO_LED_STATUS_EN, MICROP_I2C_WCMD_GPO_LED_STATUS_DIS, gpo_mask, true);
 
 	if (ret < 0)
     {
@@ -197,12 +387,9 @@ int microp_gpo_enable(uint16_t gpo_mask)
 
 int microp_gpo_disable(uint16_t gpo_mask)
 {
-	uint8_t data[2];
 	int ret = -1;
 
-	data[0] = gpo_mask >> 8;
-	data[1] = gpo_mask & 0xFF;
-	ret = microp_i2c_write(MICROP_I2C_WCMD_GPO_LED_STATUS_DIS, data, 2);
+	ret = microp_mask_update(&microp_gpo, MICROP_I2C_WCMD_GPO_LED_STATUS_EN, MICROP_I2C_WCMD_GPO_LED_STATUS_DIS, gpo_mask, false);
 
 	if (ret < 0) {
 		DEBUG((EFI_D_ERROR, "%s: disable 0x%x interrupt failed\n", __func__, gpo_mask));
@@ -260,67 +447,186 @@ int capella_cm3602_power(int pwr_device, uint8_t enable)
 }*/
 
 /*
-static irqreturn_t microp_i2c_intr_irq_handler(int irq, void *dev_id)
+ * GPI interrupts: the MicroP pulls UP_INT_N low while an enabled GPI event
+ * is pending. The pin is level triggered and GpioDxe leaves it masked, the
+ * worker reads and clears the status and only then unmasks it. While the
+ * status cannot be read the line stays masked, unmasking it would fire
+ * again at once, and the worker retries from its timer.
+ */
+#define MICROP_IRQ_RETRY_MIN_MS 10
+#define MICROP_IRQ_RETRY_MAX_MS 1000
+// Back off from a caller the worker preempted
+#define MICROP_IRQ_BUSY_MS 1
+
+struct microp_irq_action {
+	microp_irq_handler_t handler;
+	void *context;
+};
+
+static struct microp_irq_action microp_irq_actions[16];
+// Events with a handler, enabled on the MicroP
+static uint16_t microp_irq_enabled;
+static UINTN microp_irq_retry_ms = MICROP_IRQ_RETRY_MIN_MS;
+static TLMM_GPIO_INTERRUPT *gGpioIrq = NULL;
+// Signalled from the pin handler, also the retry timer
+static EFI_EVENT microp_irq_work;
+static EFI_EVENT microp_exit_boot_services;
+
+static VOID EFIAPI microp_i2c_intr_irq_handler(TLMM_GPIO_PIN gpio, UINTN level, VOID *context)
 {
-	disable_irq_nosync(client->irq);
-	schedule_work(&cdata->work.work);
-	return IRQ_HANDLED;
+	gBS->SignalEvent(microp_irq_work);
 }
 
-static void microp_i2c_intr_work_func(struct work_struct *work)
+/*
+ * Reads and clears the pending GPI events in a single transaction. The
+ * clear message goes out after the read completed and sends the status
+ * bytes it stored, clearing exactly what we saw.
+ */
+static int microp_interrupt_read_clear(uint16_t *status)
 {
-	struct microp_i2c_work *up_work;
-	struct i2c_client *client;
-	struct microp_i2c_client_data *cdata;
-	uint8_t data[3];
-	uint16_t intr_status = 0;
-	int ret = 0;
+	uint8_t addr = MICROP_I2C_RCMD_GPI_INT_STATUS;
+	uint8_t clr[3] = { MICROP_I2C_WCMD_GPI_INT_STATUS_CLR, 0, 0 };
+	struct i2c_msg msgs[] = {
+		{.addr = pdata->chip,	.flags = 0,		.len = 1,	.buf = &addr,},
+		{.addr = pdata->chip,	.flags = I2C_M_RD,	.len = 2,	.buf = &clr[1],},
+		{.addr = pdata->chip,	.flags = 0,		.len = 3,	.buf = clr,},
+	};
+	int ret;
 
-	up_work = container_of(work, struct microp_i2c_work, work);
-	client = up_work->client;
-	cdata = i2c_get_clientdata(client);
+	microp_busy++;
+	ret = microp_flush_with(msgs, 3);
+	microp_busy--;
+	if (ret < 0)
+		return ret;
 
-	ret = microp_interrupt_get_status(&intr_status);
-	if (ret < 0) {
-		dprintf(CRITICAL, "%s: read interrupt status fail\n", __func__);
+	*status = clr[1] << 8 | clr[2];
+	return 0;
+}
+
+static VOID EFIAPI microp_i2c_intr_work_func(IN EFI_EVENT Event, IN VOID *Context)
+{
+	uint16_t intr_status;
+	int i;
+
+	if (microp_busy) {
+		gBS->SetTimer(microp_irq_work, TimerRelative, EFI_TIMER_PERIOD_MILLISECONDS(MICROP_IRQ_BUSY_MS));
+		return;
 	}
 
-	ret = msm_i2c_read(MICROP_ADDR, MICROP_I2C_WCMD_GPI_INT_STATUS_CLR, data, 2);
-	if (ret < 0) {
-		dprintf(CRITICAL, "%s: clear interrupt status fail\n", __func__);
+	if (microp_interrupt_read_clear(&intr_status) < 0) {
+		DEBUG((EFI_D_ERROR, "%s: read interrupt status fail, retry in %d ms\n", __func__, microp_irq_retry_ms));
+		gBS->SetTimer(microp_irq_work, TimerRelative, EFI_TIMER_PERIOD_MILLISECONDS(microp_irq_retry_ms));
+		microp_irq_retry_ms = MIN(microp_irq_retry_ms * 2, MICROP_IRQ_RETRY_MAX_MS);
+		return;
 	}
+	microp_irq_retry_ms = MICROP_IRQ_RETRY_MIN_MS;
+
+	// Only sent if the failure dropped the shadow, the MicroP may be back
+	// from a reset with every event disabled
+	microp_interrupt_enable(microp_irq_enabled);
 
-	if (intr_status & IRQ_PROXIMITY) {
-		p_sensor_irq_handler();
+	for (i = 0; i < 16; i++) {
+		if ((intr_status & (1 << i)) && microp_irq_actions[i].handler)
+			microp_irq_actions[i].handler(1 << i, microp_irq_actions[i].context);
 	}
 
-	enable_irq(client->irq);
+	gGpioIrq->Unmask(HTCLEO_GPIO_UP_INT_N);
 }
 
+int microp_irq_register(uint16_t mask, microp_irq_handler_t handler, void *context)
+{
+	int i;
+
+	if (!gGpioIrq || !handler || !mask)
+		return -1;
+
+	for (i = 0; i < 16; i++) {
+		if ((mask & (1 << i)) && microp_irq_actions[i].handler)
+			return -1;
+	}
+
+	for (i = 0; i < 16; i++) {
+		if (mask & (1 << i)) {
+			microp_irq_actions[i].handler = handler;
+			microp_irq_actions[i].context = context;
+		}
+	}
+	microp_irq_enabled |= mask;
+
+	return microp_interrupt_enable(mask);
+}
+
+int microp_irq_unregister(uint16_t mask)
+{
+	int i;
+
+	if (!gGpioIrq)
+		return -1;
+
+	microp_irq_enabled &= ~mask;
+	for (i = 0; i < 16; i++) {
+		if (mask & (1 << i)) {
+			microp_irq_actions[i].handler = NULL;
+			microp_irq_actions[i].context = NULL;
+		}
+	}
+
+	return microp_interrupt_disable(mask);
+}
+
+static VOID EFIAPI microp_exit_boot_services_func(IN EFI_EVENT Event, IN VOID *Context)
+{
+	gBS->SetTimer(microp_irq_work, TimerCancel, 0);
+	gGpioIrq->Unregister(HTCLEO_GPIO_UP_INT_N);
+}
 
 static int microp_function_initialize(void)
-{    
-	uint16_t stat, interrupts = 0;
+{
+	EFI_STATUS Status;
+	uint16_t stat;
 	int ret;
 
-	ret = microp_interrupt_enable(interrupts);
-	if (ret < 0) {
-		DEBUG((EFI_D_ERROR, "%s: failed to enable gpi irqs\n", __func__));
+	Status = gBS->LocateProtocol(&gTlmmGpioInterruptProtocolGuid, NULL, (VOID **)&gGpioIrq);
+	if (EFI_ERROR(Status)) {
+		gGpioIrq = NULL;
+		return -1;
+	}
+
+	Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK, microp_i2c_intr_work_func, NULL, &microp_irq_work);
+	ASSERT_EFI_ERROR(Status);
+
+	// Nothing is handled yet, disable and clear everything in one go
+	microp_batch_begin();
+	microp_interrupt_disable(0xFFFF);
+	ret = microp_interrupt_read_clear(&stat);
+	microp_batch_end();
+	if (ret < 0)
+		goto err_irq_en;
+
+	Status = gGpioIrq->Register(HTCLEO_GPIO_UP_INT_N, GpioTriggerLevelLow, 0, microp_i2c_intr_irq_handler, NULL);
+	if (EFI_ERROR(Status)) {
+		DEBUG((EFI_D_ERROR, "%s: no IRQ on gpio %d\n", __func__, HTCLEO_GPIO_UP_INT_N));
+		ret = -1;
 		goto err_irq_en;
 	}
 
-	microp_read_gpi_status(&stat);
+	Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY, microp_exit_boot_services_func, NULL, &microp_exit_boot_services);
+	ASSERT_EFI_ERROR(Status);
+
 	return 0;
 
 err_irq_en:
+	gBS->CloseEvent(microp_irq_work);
+	gGpioIrq = NULL;
 	return ret;
-}*/
+}
 
 void microp_i2c_probe(struct microp_platform_data *kpdata)
 {
 	if(!kpdata || pdata) return;
 
 	pdata = kpdata;
+	microp_shadow_invalidate();
 	
 	uint8_t data[6];
 	if (microp_i2c_read(MICROP_I2C_RCMD_VERSION, data, 2) < 0) {
@@ -330,10 +636,11 @@ void microp_i2c_probe(struct microp_platform_data *kpdata)
 	}
 	DEBUG((EFI_D_ERROR, "HTC MicroP 0x%02X\n", data[0]));
 	msm_microp_i2c_status = 1;
+
+	if (microp_function_initialize() < 0)
+		DEBUG((EFI_D_ERROR, "microp: GPI interrupts unavailable\n"));
 	
 	//gpio_set(pdata->gpio_reset, 1);
-	
-	//microp_function_initialize();
 }
 
 void htcleo_led_set_mode(uint8_t mode)
@@ -367,7 +674,11 @@ void htcleo_led_set_mode(uint8_t mode)
 HTCLEO_MICROP_PROTOCOL gHtcLeoMicropProtocol = {
   microp_i2c_write,
   microp_i2c_read,
-  htcleo_led_set_mode
+  htcleo_led_set_mode,
+  microp_batch_begin,
+  microp_batch_end,
+  microp_irq_register,
+  microp_irq_unregister
 };
 
 EFI_STATUS
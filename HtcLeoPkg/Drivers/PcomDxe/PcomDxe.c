@@ -0,0 +1,498 @@
+/*
+ * Interrupt completed proc_comm transport
+ *
+ * Requests are queued and handed to the modem one at a time. Completion is
+ * picked up from the modem's M2A interrupt, a slow poll timer covers modem
+ * builds that don't raise it and enforces the per command deadline. The
+ * CPU is free to do other work (or sleep) while the modem is busy.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <Uefi.h>
+
+#include <Library/ArmLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/IoLib.h>
+#include <Library/LKEnvLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/pcom.h>
+
+#include <Chipset/irqs.h>
+
+#include <Protocol/HardwareInterrupt.h>
+#include <Protocol/HtcLeoPcom.h>
+
+// Raised by the modem when it finished a command
+#define PCOM_DONE_IRQ			INT_A9_M2A_6
+
+// Fallback completion check and deadline enforcement, the timer tick
+// rounds it up to its own period
+#define PCOM_POLL_PERIOD_MS		1
+
+// Synchronous callers busy poll this long before sleeping on completion
+#define PCOM_SPIN_US			1000
+
+EFI_HARDWARE_INTERRUPT_PROTOCOL *gInterrupt = NULL;
+
+STATIC LIST_ENTRY mQueue = INITIALIZE_LIST_HEAD_VARIABLE(mQueue);
+STATIC HTCLEO_PCOM_REQUEST *mActive = NULL;
+STATIC EFI_EVENT mServiceEvent;
+STATIC EFI_EVENT mPollTimer;
+STATIC EFI_EVENT mExitBootServicesEvent;
+STATIC BOOLEAN mDoneIrq = FALSE;
+STATIC BOOLEAN mModemHung = FALSE;
+STATIC struct pcom_stats mStats;
+
+// Tracer ring, written at completion only
+STATIC HTCLEO_PCOM_TRACE_ENTRY mTrace[PCOM_TRACE_ENTRIES];
+STATIC UINT64 mTraceTotal;
+
+STATIC UINT32 PcomElapsedUs(UINT32 Start)
+{
+	return (UINT32)DivU64x32(GetTimeInNanoSecond((UINT32)GetPerformanceCounter() - Start), 1000);
+}
+
+STATIC VOID PcomNotifyModem(VOID)
+{
+	ArmDataSynchronizationBarrier();
+	writel(1, MSM_A2M_INT(6));
+}
+
+STATIC UINT32 PcomTicksToUs(UINT32 Ticks)
+{
+	return (UINT32)DivU64x32(GetTimeInNanoSecond(Ticks), 1000);
+}
+
+STATIC VOID PcomTrace(HTCLEO_PCOM_REQUEST *Request, INTN Status)
+{
+	HTCLEO_PCOM_TRACE_ENTRY *e = &mTrace[mTraceTotal % PCOM_TRACE_ENTRIES];
+	UINT32 now = (UINT32)GetPerformanceCounter();
+	UINT32 issued = Request->Issued ? Request->IssuedAt : now;
+
+	e->Command = Request->Command;
+	e->Data1 = Request->Arg1;
+	e->Data2 = Request->Arg2;
+	e->Status = (INT32)Status;
+	e->StartUs = PcomTicksToUs(Request->Queued);
+	e->QueueUs = PcomTicksToUs(issued - Request->Queued);
+	e->LatencyUs = PcomTicksToUs(now - issued);
+	mTraceTotal++;
+}
+
+STATIC VOID PcomComplete(HTCLEO_PCOM_REQUEST *Request, INTN Status)
+{
+	UINT32 elapsed = PcomElapsedUs(Request->Start);
+
+	PcomTrace(Request, Status);
+
+	Request->Status = Status;
+	Request->Done = TRUE;
+
+	if (Status == ERR_TIMED_OUT) {
+		mStats.timeouts++;
+	} else {
+		if (Status != 0)
+			mStats.failures++;
+		mStats.last_us = elapsed;
+		mStats.total_us += elapsed;
+		if (elapsed > mStats.max_us) {
+			mStats.max_us = elapsed;
+			mStats.max_cmd = Request->Command;
+		}
+	}
+
+	if (Request->Event != NULL)
+		gBS->SignalEvent(Request->Event);
+}
+
+/*
+ * Advances the queue: finishes the active request if the modem is done
+ * with it or it ran out of time, then issues the next one.
+ * Runs at TPL_NOTIFY or above.
+ */
+STATIC VOID PcomServiceLocked(VOID)
+{
+	HTCLEO_PCOM_REQUEST *req;
+	UINT32 timeout;
+
+	while (TRUE) {
+		if (mActive == NULL) {
+			if (IsListEmpty(&mQueue)) {
+				gBS->SetTimer(mPollTimer, TimerCancel, 0);
+				return;
+			}
+			mActive = BASE_CR(GetFirstNode(&mQueue), HTCLEO_PCOM_REQUEST, Link);
+			RemoveEntryList(&mActive->Link);
+			mActive->Start = (UINT32)GetPerformanceCounter();
+			gBS->SetTimer(mPollTimer, TimerPeriodic, EFI_TIMER_PERIOD_MILLISECONDS(PCOM_POLL_PERIOD_MS));
+		}
+
+		req = mActive;
+		timeout = req->TimeoutUs ? req->TimeoutUs : PCOM_CMD_TIMEOUT_US;
+
+		if (!req->Issued) {
+			// A hung modem is back once it finished what we gave up on
+			if (readl(MDM_STATUS) != PCOM_READY ||
+			    (mModemHung && readl(APP_COMMAND) != PCOM_CMD_DONE &&
+			     readl(APP_COMMAND) != PCOM_CMD_IDLE)) {
+				if (PcomElapsedUs(req->Start) < (mModemHung ? PCOM_POLL_MAX_US : PCOM_READY_TIMEOUT_US))
+					return;
+				DEBUG((EFI_D_ERROR, "[PCOM]: modem not ready [cmd:%x]\n", req->Command));
+				mModemHung = TRUE;
+				mActive = NULL;
+				PcomComplete(req, ERR_TIMED_OUT);
+				continue;
+			}
+
+			if (mModemHung) {
+				DEBUG((EFI_D_ERROR, "[PCOM]: modem is responding again\n"));
+				mModemHung = FALSE;
+			}
+
+			writel(req->Command, APP_COMMAND);
+			writel(req->Data1, APP_DATA1);
+			writel(req->Data2, APP_DATA2);
+			PcomNotifyModem();
+
+			req->Issued = TRUE;
+			req->Start = (UINT32)GetPerformanceCounter();
+			req->IssuedAt = req->Start;
+			return;
+		}
+
+		if (readl(APP_COMMAND) != PCOM_CMD_DONE) {
+			if (PcomElapsedUs(req->Start) < timeout)
+				return;
+
+			if (req->Retries < PCOM_CMD_RETRIES) {
+				// Only the interrupt is repeated, the command must not run twice
+				req->Retries++;
+				mStats.retries++;
+				req->Start = (UINT32)GetPerformanceCounter();
+				PcomNotifyModem();
+				return;
+			}
+
+			// APP_COMMAND is left alone, the modem still owns it
+			DEBUG((EFI_D_ERROR, "[PCOM]: TIMEOUT [cmd:%x]\n", req->Command));
+			mModemHung = TRUE;
+			mActive = NULL;
+			PcomComplete(req, ERR_TIMED_OUT);
+			continue;
+		}
+
+		if (readl(APP_STATUS) != PCOM_CMD_FAIL) {
+			req->Data1 = readl(APP_DATA1);
+			req->Data2 = readl(APP_DATA2);
+			writel(PCOM_CMD_IDLE, APP_COMMAND);
+			mActive = NULL;
+			PcomComplete(req, 0);
+		} else {
+			DEBUG((EFI_D_INFO, "[PCOM]: FAIL [cmd:%x D1:%x D2:%x]\n", req->Command, req->Data1, req->Data2));
+			writel(PCOM_CMD_IDLE, APP_COMMAND);
+			mActive = NULL;
+			PcomComplete(req, -1);
+		}
+	}
+}
+
+STATIC VOID EFIAPI PcomServiceNotify(IN EFI_EVENT Event, IN VOID *Context)
+{
+	PcomServiceLocked();
+}
+
+STATIC VOID EFIAPI PcomInterruptHandler(
+	IN HARDWARE_INTERRUPT_SOURCE Source,
+	IN EFI_SYSTEM_CONTEXT SystemContext)
+{
+	gBS->SignalEvent(mServiceEvent);
+}
+
+STATIC EFI_TPL PcomCurrentTpl(VOID)
+{
+	EFI_TPL Tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	gBS->RestoreTPL(Tpl);
+	return Tpl;
+}
+
+STATIC VOID PcomQueueLocked(HTCLEO_PCOM_REQUEST *Request)
+{
+	Request->Done = FALSE;
+	Request->Issued = FALSE;
+	Request->Retries = 0;
+	Request->Status = ERR_NOT_READY;
+	Request->Start = (UINT32)GetPerformanceCounter();
+	Request->Queued = Request->Start;
+	Request->Arg1 = Request->Data1;
+	Request->Arg2 = Request->Data2;
+
+	mStats.calls++;
+	InsertTailList(&mQueue, &Request->Link);
+	PcomServiceLocked();
+}
+
+EFI_STATUS PcomSubmit(HTCLEO_PCOM_REQUEST *Request)
+{
+	EFI_TPL OldTpl;
+
+	if (Request == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	// The queue is guarded by TPL_NOTIFY, use Call from above it
+	if (PcomCurrentTpl() > TPL_NOTIFY)
+		return EFI_ACCESS_DENIED;
+
+	OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+	PcomQueueLocked(Request);
+	gBS->RestoreTPL(OldTpl);
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * Drives the queue until Last is done, giving up after BoundUs if that's
+ * not 0. Runs at TPL_NOTIFY or above.
+ */
+STATIC BOOLEAN PcomSpinLocked(HTCLEO_PCOM_REQUEST *Last, UINTN BoundUs)
+{
+	UINTN delay = PCOM_POLL_MIN_US;
+	UINTN spent = 0;
+
+	while (!Last->Done) {
+		if (BoundUs != 0 && spent >= BoundUs)
+			return FALSE;
+		MicroSecondDelay(delay);
+		spent += delay;
+		if (delay < PCOM_POLL_MAX_US)
+			delay <<= 1;
+		PcomServiceLocked();
+	}
+
+	return TRUE;
+}
+
+/*
+ * Runs requests to completion for the synchronous callers. They are
+ * queued back to back, so the last one finishing means all are done.
+ *
+ * Most commands are answered within a few hundred microseconds, long
+ * before the poll timer (serviced on the 10 ms timer tick) would notice,
+ * and the completion interrupt is missing on some modem builds. So the
+ * queue is busy polled for PCOM_SPIN_US first. At TPL_APPLICATION
+ * anything slower is then waited for through WaitForEvent so the core
+ * can idle in WFI. Callers at raised TPLs block the service event anyway
+ * and keep driving the queue themselves.
+ */
+STATIC EFI_STATUS PcomRun(HTCLEO_PCOM_REQUEST *Requests, UINTN Count)
+{
+	HTCLEO_PCOM_REQUEST *last = &Requests[Count - 1];
+	EFI_TPL Tpl, OldTpl;
+	EFI_STATUS Status = EFI_SUCCESS;
+	BOOLEAN done;
+	UINTN Index, n;
+
+	Tpl = PcomCurrentTpl();
+	if (Tpl == TPL_APPLICATION &&
+	    EFI_ERROR(gBS->CreateEvent(0, 0, NULL, NULL, &last->Event)))
+		last->Event = NULL;
+
+	if (Tpl > TPL_NOTIFY) {
+		for (n = 0; n < Count; n++)
+			PcomQueueLocked(&Requests[n]);
+	} else {
+		for (n = 0; n < Count; n++) {
+			Status = PcomSubmit(&Requests[n]);
+			if (EFI_ERROR(Status))
+				break;
+		}
+		if (n < Count) {
+			DEBUG((EFI_D_ERROR, "[PCOM]: submit failed: %r\n", Status));
+			for (Index = n; Index < Count; Index++) {
+				Requests[Index].Status = -1;
+				Requests[Index].Done = TRUE;
+			}
+			// Whatever went in still has to finish, it lives on our stack
+			if (last->Event != NULL) {
+				gBS->CloseEvent(last->Event);
+				last->Event = NULL;
+			}
+			if (n == 0)
+				return Status;
+			last = &Requests[n - 1];
+		}
+	}
+
+	OldTpl = Tpl;
+	if (Tpl < TPL_NOTIFY)
+		OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+	done = PcomSpinLocked(last, last->Event != NULL ? PCOM_SPIN_US : 0);
+	if (Tpl < TPL_NOTIFY)
+		gBS->RestoreTPL(OldTpl);
+
+	// Only with an event, i.e. at TPL_APPLICATION
+	if (!done && EFI_ERROR(gBS->WaitForEvent(1, &last->Event, &Index))) {
+		OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+		PcomSpinLocked(last, 0);
+		gBS->RestoreTPL(OldTpl);
+	}
+
+	if (last->Event != NULL) {
+		gBS->CloseEvent(last->Event);
+		last->Event = NULL;
+	}
+
+	return Status;
+}
+
+// Synchronous wrapper for the msm_proc_comm() callers
+INTN PcomCall(UINT32 cmd, UINT32 *data1, UINT32 *data2)
+{
+	HTCLEO_PCOM_REQUEST req;
+
+	ZeroMem(&req, sizeof(req));
+	req.Command = cmd;
+	req.Data1 = data1 ? *data1 : 0;
+	req.Data2 = data2 ? *data2 : 0;
+
+	if (EFI_ERROR(PcomRun(&req, 1)))
+		return -1;
+
+	if (req.Status == 0) {
+		if (data1) *data1 = req.Data1;
+		if (data2) *data2 = req.Data2;
+	}
+
+	return req.Status;
+}
+
+INTN PcomCallBatch(struct pcom_cmd *cmds, UINTN count)
+{
+	HTCLEO_PCOM_REQUEST req[PCOM_BATCH_MAX];
+	UINTN n, chunk, done;
+	INTN failed = 0;
+
+	for (done = 0; done < count; done += chunk) {
+		chunk = MIN(count - done, PCOM_BATCH_MAX);
+
+		ZeroMem(req, sizeof(req));
+		for (n = 0; n < chunk; n++) {
+			req[n].Command = cmds[done + n].cmd;
+			req[n].Data1 = cmds[done + n].data1;
+			req[n].Data2 = cmds[done + n].data2;
+		}
+
+		PcomRun(req, chunk);
+
+		for (n = 0; n < chunk; n++) {
+			cmds[done + n].status = req[n].Status;
+			if (req[n].Status == 0) {
+				cmds[done + n].data1 = req[n].Data1;
+				cmds[done + n].data2 = req[n].Data2;
+			} else {
+				failed++;
+			}
+		}
+	}
+
+	return failed;
+}
+
+VOID PcomGetStats(struct pcom_stats *stats)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	CopyMem(stats, &mStats, sizeof(mStats));
+	gBS->RestoreTPL(OldTpl);
+}
+
+UINTN PcomGetTrace(HTCLEO_PCOM_TRACE_ENTRY *Entries, UINTN Count, UINT64 *Total)
+{
+	EFI_TPL OldTpl;
+	UINT64 first;
+	UINTN n;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	Count = (UINTN)MIN((UINT64)Count, MIN(mTraceTotal, PCOM_TRACE_ENTRIES));
+	first = mTraceTotal - Count;
+	for (n = 0; n < Count; n++)
+		CopyMem(&Entries[n], &mTrace[(first + n) % PCOM_TRACE_ENTRIES], sizeof(*Entries));
+	if (Total)
+		*Total = mTraceTotal;
+	gBS->RestoreTPL(OldTpl);
+
+	return Count;
+}
+
+VOID PcomResetTrace(VOID)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	mTraceTotal = 0;
+	ZeroMem(&mStats, sizeof(mStats));
+	gBS->RestoreTPL(OldTpl);
+}
+
+STATIC VOID EFIAPI PcomExitBootServices(IN EFI_EVENT Event, IN VOID *Context)
+{
+	gBS->SetTimer(mPollTimer, TimerCancel, 0);
+	if (mDoneIrq) {
+		// Unregistering alone leaves the source enabled at the VIC
+		gInterrupt->DisableInterruptSource(gInterrupt, PCOM_DONE_IRQ);
+		gInterrupt->RegisterInterruptSource(gInterrupt, PCOM_DONE_IRQ, NULL);
+	}
+}
+
+HTCLEO_PCOM_PROTOCOL gHtcLeoPcomProtocol = {
+	PcomSubmit,
+	PcomCall,
+	PcomCallBatch,
+	PcomGetStats,
+	PcomGetTrace,
+	PcomResetTrace
+};
+
+EFI_STATUS
+EFIAPI
+PcomDxeInitialize(
+	IN EFI_HANDLE         ImageHandle,
+	IN EFI_SYSTEM_TABLE   *SystemTable
+)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE Handle = NULL;
+
+	Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_NOTIFY, PcomServiceNotify, NULL, &mServiceEvent);
+	ASSERT_EFI_ERROR(Status);
+
+	Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY, PcomServiceNotify, NULL, &mPollTimer);
+	ASSERT_EFI_ERROR(Status);
+
+	// Without the interrupt completions are only seen by the poll timer
+	Status = gBS->LocateProtocol(&gHardwareInterruptProtocolGuid, NULL, (VOID **)&gInterrupt);
+	ASSERT_EFI_ERROR(Status);
+	Status = gInterrupt->RegisterInterruptSource(gInterrupt, PCOM_DONE_IRQ, PcomInterruptHandler);
+	mDoneIrq = !EFI_ERROR(Status);
+	if (!mDoneIrq)
+		DEBUG((EFI_D_ERROR, "PcomDxe: no completion interrupt, polling\n"));
+
+	Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY, PcomExitBootServices, NULL, &mExitBootServicesEvent);
+	ASSERT_EFI_ERROR(Status);
+
+	Status = gBS->InstallMultipleProtocolInterfaces(
+		&Handle, &gHtcLeoPcomProtocolGuid, &gHtcLeoPcomProtocol, NULL);
+	ASSERT_EFI_ERROR(Status);
+
+	return Status;
+}
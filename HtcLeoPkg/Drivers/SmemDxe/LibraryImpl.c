@@ -12,6 +12,7 @@ STATIC QCOM_SMEM_PROTOCOL mInternalSMEM = {
     smem_read_alloc_entry,
     smem_read_alloc_entry_offset,
     smem_get_alloc_entry,
+    smem_get_item,
 };
 
 RETURN_STATUS
@@ -52,102 +52,139 @@ static uint32_t smem_get_base_addr(void)
     return (UINT32)PcdGet64(PcdMsmSharedBase);
 }
 
-/* buf MUST be 4byte aligned, and len MUST be a multiple of 8. */
-unsigned smem_read_alloc_entry(smem_mem_type_t type, void *buf, int len)
+/*
+ * Where each allocated item lives, taken from the allocation table once.
+ * Items are never freed or moved once allocated, so an entry stays valid;
+ * items the modem allocates later are picked up on their first lookup.
+ */
+struct smem_index_entry {
+  uint8_t *addr;
+  uint32_t size;
+};
+
+static struct smem_index_entry smem_index[SMEM_MAX_SIZE];
+static int                     smem_index_built = 0;
+
+static void smem_index_add(smem_mem_type_t type)
 {
-  struct smem_alloc_info *ainfo;
-  unsigned *              dest = buf;
-  unsigned                src;
-  unsigned                size;
-  uint32_t                smem_addr = 0;
-  struct smem *           smem;
+  struct smem *           smem = (struct smem *)smem_get_base_addr();
+  struct smem_alloc_info *ainfo = &smem->alloc_info[type];
+  uint32_t                base_ext;
 
-  smem_addr = smem_get_base_addr();
-  smem      = (struct smem *)smem_addr;
+  if (readl(&ainfo->allocated) == 0)
+    return;
 
-  if (((len & 0x3) != 0) || (((unsigned)buf & 0x3) != 0))
-    return 1;
+  base_ext = readl(&ainfo->base_ext);
+
+  smem_index[type].size = readl(&ainfo->size);
+  smem_index[type].addr = (uint8_t *)(base_ext ? base_ext : (uint32_t)smem) +
+                          readl(&ainfo->offset);
+}
 
+static void smem_index_build(void)
+{
+  int type;
+
+  for (type = SMEM_FIRST_VALID_TYPE; type <= SMEM_LAST_VALID_TYPE; type++)
+    smem_index_add(type);
+
+  smem_index_built = 1;
+}
+
+static struct smem_index_entry *smem_index_lookup(smem_mem_type_t type)
+{
   if (type < SMEM_FIRST_VALID_TYPE || type > SMEM_LAST_VALID_TYPE)
+    return NULL;
+
+  if (!smem_index_built)
+    smem_index_build();
+
+  if (smem_index[type].addr == NULL)
+    smem_index_add(type);
+
+  return smem_index[type].addr ? &smem_index[type] : NULL;
+}
+
+/*
+ * Only the SMEM window itself is known to be mapped uncached, base_ext
+ * items elsewhere are left to the copying readers.
+ */
+static int smem_in_window(struct smem_index_entry *entry)
+{
+  uint32_t base = smem_get_base_addr();
+  uint32_t addr = (uint32_t)entry->addr;
+
+  return addr >= base && entry->size <= (uint32_t)PcdGet64(PcdMsmSharedSize) &&
+         addr - base <= (uint32_t)PcdGet64(PcdMsmSharedSize) - entry->size;
+}
+
+/* Copy len bytes from offset into the item, word by word */
+static unsigned smem_copy_item(
+    smem_mem_type_t type, void *buf, int len, int offset, int padded)
+{
+  struct smem_index_entry *entry;
+  unsigned *               dest = buf;
+  unsigned                 src;
+  unsigned                 need;
+
+  if (((len & 0x3) != 0) || (((unsigned)buf & 0x3) != 0))
     return 1;
 
   /* TODO: Use smem spinlocks */
-  ainfo = &smem->alloc_info[type];
-  if (readl(&ainfo->allocated) == 0)
+  entry = smem_index_lookup(type);
+  if (entry == NULL)
     return 1;
 
-  size = readl(&ainfo->size);
-
-  if (size < (unsigned)((len + 7) & ~0x00000007))
+  /* Whole reads were always checked against the size rounded up to 8 */
+  need = offset + (padded ? ((len + 7) & ~0x00000007) : len);
+  if (offset < 0 || entry->size < need)
     return 1;
 
-  src = smem_addr + readl(&ainfo->offset);
+  src = (unsigned)entry->addr + offset;
   for (; len > 0; src += 4, len -= 4)
     *(dest++) = readl(src);
 
   return 0;
 }
 
+/* buf MUST be 4byte aligned, and len MUST be a multiple of 8. */
+unsigned smem_read_alloc_entry(smem_mem_type_t type, void *buf, int len)
+{
+  return smem_copy_item(type, buf, len, 0, 1);
+}
+
 /* Return a pointer to smem_item with size */
 void *smem_get_alloc_entry(smem_mem_type_t type, uint32_t *size)
 {
-  struct smem_alloc_info *ainfo     = NULL;
-  uint32_t                smem_addr = 0;
-  struct smem *           smem;
-  uint32_t                base_ext = 0;
-  uint32_t                offset   = 0;
-  void *                  ret      = NULL;
-
-  smem_addr = smem_get_base_addr();
-  smem      = (struct smem *)smem_addr;
-
-  if (type < SMEM_FIRST_VALID_TYPE || type > SMEM_LAST_VALID_TYPE)
-    return ret;
-
-  ainfo = &smem->alloc_info[type];
-  if (readl(&ainfo->allocated) == 0)
-    return ret;
-
-  *size    = readl(&ainfo->size);
-  base_ext = readl(&ainfo->base_ext);
-  offset   = readl(&ainfo->offset);
+  struct smem_index_entry *entry;
 
-  if (base_ext) {
-    ret = (void *)base_ext + offset;
-  }
-  else {
-    ret = (void *)smem_addr + offset;
-  }
+  entry = smem_index_lookup(type);
+  if (entry == NULL)
+    return NULL;
 
-  return ret;
+  *size = entry->size;
+  return entry->addr;
 }
 
 unsigned smem_read_alloc_entry_offset(
     smem_mem_type_t type, void *buf, int len, int offset)
 {
-  struct smem_alloc_info *ainfo;
-  unsigned *              dest = buf;
-  unsigned                src;
-  unsigned                size      = len;
-  uint32_t                smem_addr = 0;
-  struct smem *           smem;
-
-  smem_addr = smem_get_base_addr();
-  smem      = (struct smem *)smem_addr;
-
-  if (((len & 0x3) != 0) || (((unsigned)buf & 0x3) != 0))
-    return 1;
-
-  if (type < SMEM_FIRST_VALID_TYPE || type > SMEM_LAST_VALID_TYPE)
-    return 1;
+  return smem_copy_item(type, buf, len, offset, 0);
+}
 
-  ainfo = &smem->alloc_info[type];
-  if (readl(&ainfo->allocated) == 0)
-    return 1;
+/*
+ * Pointer straight into the item, NULL unless it is allocated, holds at
+ * least min_size bytes and lies in the uncached SMEM window.
+ */
+void *smem_get_item(smem_mem_type_t type, uint32_t min_size, uint32_t *size)
+{
+  struct smem_index_entry *entry;
 
-  src = smem_addr + readl(&ainfo->offset) + offset;
-  for (; size > 0; src += 4, size -= 4)
-    *(dest++) = readl(src);
+  entry = smem_index_lookup(type);
+  if (entry == NULL || entry->size < min_size || !smem_in_window(entry))
+    return NULL;
 
-  return 0;
+  if (size != NULL)
+    *size = entry->size;
+  return entry->addr;
 }
@@ -6,5 +6,6 @@ unsigned smem_read_alloc_entry(smem_mem_type_t type, void *buf, int max_len);
 unsigned smem_read_alloc_entry_offset(
     smem_mem_type_t type, void *buf, int len, int offset);
 void *smem_get_alloc_entry(smem_mem_type_t type, uint32_t *size);
+void *smem_get_item(smem_mem_type_t type, uint32_t min_size, uint32_t *size);
 
 #endif // _SMEM_PRIVATE_H
@@ -197,25 +197,22 @@ static void smem_copy_ram_ptable(void *buf)
   }
 }
 
-/* RAM Partition table from SMEM */
-static uint32_t buffer[sizeof(struct smem_ram_ptable_v2)];
-int             smem_ram_ptable_init_v1(void)
+/* RAM Partition table from SMEM, parsed in place */
+int smem_ram_ptable_init_v1(void)
 {
-  uint32_t                    i;
-  uint32_t                    ret;
   uint32_t                    version;
   uint32_t                    smem_ram_ptable_size = 0;
   struct smem_ram_ptable_hdr *ram_ptable_hdr;
 
   /* Check smem ram partition table version and decide on length of ram_ptable
    */
-  ret = gSMEM->smem_read_alloc_entry_offset(
-      SMEM_USABLE_RAM_PARTITION_TABLE, &version, sizeof(version),
-      SMEM_RAM_PTABLE_VERSION_OFFSET);
-
-  if (ret)
+  ram_ptable_hdr =
+      SMEM_ITEM(SMEM_USABLE_RAM_PARTITION_TABLE, struct smem_ram_ptable_hdr);
+  if (ram_ptable_hdr == NULL)
     return 0;
 
+  version = ram_ptable_hdr->version;
+
   if (version == SMEM_RAM_PTABLE_VERSION_2)
     smem_ram_ptable_size = sizeof(struct smem_ram_ptable_v2);
   else if (version == SMEM_RAM_PTABLE_VERSION_1)
@@ -227,18 +224,16 @@ int             smem_ram_ptable_init_v1(void)
     ASSERT(0);
   }
 
-  i = gSMEM->smem_read_alloc_entry(
-      SMEM_USABLE_RAM_PARTITION_TABLE, (void *)buffer, smem_ram_ptable_size);
-  if (i != 0)
+  /* The item has to hold the whole table of that version */
+  if (gSMEM->smem_get_item(
+          SMEM_USABLE_RAM_PARTITION_TABLE, smem_ram_ptable_size, NULL) == NULL)
     return 0;
 
-  ram_ptable_hdr = (struct smem_ram_ptable_hdr *)buffer;
-
   if (ram_ptable_hdr->magic[0] != _SMEM_RAM_PTABLE_MAGIC_1 ||
       ram_ptable_hdr->magic[1] != _SMEM_RAM_PTABLE_MAGIC_2)
     return 0;
 
-  smem_copy_ram_ptable((void *)buffer);
+  smem_copy_ram_ptable((void *)ram_ptable_hdr);
 
   dprintf(
       SPEW, "smem ram ptable found: ver: %u len: %u\n", ram_ptable_hdr->version,
@@ -0,0 +1,213 @@
+/*
+ * ACPU frequency governor
+ *
+ * Judges the share of timer ticks that found the Scorpion in WFI and
+ * moves along acpu_freq_tbl: straight to the top step once the CPU is
+ * busy, one step down per window while it idles. The AXI floor follows
+ * through acpuclk_set_rate(). The core voltage stays where the boot
+ * loader set it for the top step, which covers every lower step.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <Uefi.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/acpuclock.h>
+
+#include <Protocol/HtcLeoCpuFreq.h>
+#include <Protocol/HtcLeoInterruptControl.h>
+
+// Busy share in percent that sends the CPU to the top step
+#define GOV_UP_LOAD			60
+
+// Busy share in percent below which it steps down
+#define GOV_DOWN_LOAD		25
+
+// Timer ticks a window needs before it is judged
+#define GOV_MIN_TICKS		8
+
+STATIC HTCLEO_INTERRUPT_CONTROL_PROTOCOL *mIrqControl;
+STATIC EFI_EVENT mGovTimer;
+STATIC EFI_EVENT mGovKick;
+STATIC EFI_EVENT mGovExitBootServices;
+STATIC BOOLEAN mGovStopped = FALSE;
+
+STATIC UINTN mSteps;
+STATIC UINTN mStep;
+STATIC UINT32 mPinCount;
+STATIC UINT32 mLoad = 100;
+STATIC UINT64 mTransitions;
+STATIC UINT64 mLastIdle;
+STATIC UINT64 mLastTicks;
+
+STATIC VOID GovSetStep(UINTN Step)
+{
+	if (Step == mStep)
+		return;
+
+	if (acpuclk_set_rate(acpuclk_step_khz(Step) * 1000, SETRATE_CPUFREQ) == 0) {
+		mStep = Step;
+		mTransitions++;
+	} else if (acpuclk_get_rate() == acpuclk_step_khz(0)) {
+		// The SCPLL did not lock, the CPU was left on the MPLL
+		mStep = 0;
+		mTransitions++;
+	}
+}
+
+STATIC VOID EFIAPI GovUpdate(IN EFI_EVENT Event, IN VOID *Context)
+{
+	UINT64 Idle, Ticks;
+
+	if (mGovStopped)
+		return;
+
+	mIrqControl->GetIdleStats(&Idle, &Ticks);
+
+	if (mPinCount != 0) {
+		mLastIdle = Idle;
+		mLastTicks = Ticks;
+		GovSetStep(mSteps - 1);
+		return;
+	}
+
+	// A short window says nothing, let it grow
+	if (Ticks - mLastTicks < GOV_MIN_TICKS)
+		return;
+
+	mLoad = 100 - (UINT32)DivU64x64Remainder(
+		MultU64x32(Idle - mLastIdle, 100), Ticks - mLastTicks, NULL);
+	mLastIdle = Idle;
+	mLastTicks = Ticks;
+
+	if (mLoad >= GOV_UP_LOAD)
+		GovSetStep(mSteps - 1);
+	else if (mLoad < GOV_DOWN_LOAD && mStep > 0)
+		GovSetStep(mStep - 1);
+}
+
+VOID GovPinMax(VOID)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	mPinCount++;
+	gBS->RestoreTPL(OldTpl);
+
+	gBS->SignalEvent(mGovKick);
+}
+
+VOID GovUnpinMax(VOID)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	ASSERT(mPinCount > 0);
+	if (mPinCount > 0)
+		mPinCount--;
+	gBS->RestoreTPL(OldTpl);
+}
+
+VOID GovGetState(HTCLEO_CPU_FREQ_STATE *State)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+	State->CurrentKhz = acpuclk_get_rate();
+	State->MinKhz = acpuclk_step_khz(0);
+	State->MaxKhz = acpuclk_step_khz(mSteps - 1);
+	State->AxiKhz = acpuclk_get_axi_rate();
+	State->LoadPercent = mLoad;
+	State->PinCount = mPinCount;
+	State->Transitions = mTransitions;
+	gBS->RestoreTPL(OldTpl);
+}
+
+BOOLEAN GovGetStepStats(UINT32 Step, HTCLEO_CPU_FREQ_STEP_STATS *Stats)
+{
+	struct acpuclk_step_stats Raw;
+	EFI_TPL OldTpl;
+	int Ret;
+
+	OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+	Ret = acpuclk_get_step_stats(Step, &Raw);
+	gBS->RestoreTPL(OldTpl);
+
+	if (Ret != 0)
+		return FALSE;
+
+	Stats->Khz = acpuclk_step_khz(Step);
+	Stats->Switches = Raw.switches;
+	Stats->Hops = Raw.hops;
+	Stats->Failures = Raw.failures;
+	Stats->Timed = Raw.timed;
+	Stats->LastNs = Raw.last_ns;
+	Stats->MaxNs = Raw.max_ns;
+	Stats->TotalNs = Raw.total_ns;
+	return TRUE;
+}
+
+// Hand over at the boot speed, whatever comes next expects it
+STATIC VOID EFIAPI GovExitBootServices(IN EFI_EVENT Event, IN VOID *Context)
+{
+	mGovStopped = TRUE;
+	gBS->SetTimer(mGovTimer, TimerCancel, 0);
+	GovSetStep(mSteps - 1);
+}
+
+HTCLEO_CPU_FREQ_PROTOCOL gHtcLeoCpuFreqProtocol = {
+	GovPinMax,
+	GovUnpinMax,
+	GovGetState,
+	GovGetStepStats
+};
+
+EFI_STATUS AcpuGovernorInit(VOID)
+{
+	EFI_STATUS Status;
+	EFI_HANDLE Handle = NULL;
+	UINT32 PeriodMs = PcdGet32(PcdAcpuGovernorSampleMs);
+
+	for (mSteps = 0; acpuclk_step_khz(mSteps) != 0; mSteps++)
+		;
+	for (mStep = 0; mStep < mSteps - 1; mStep++) {
+		if (acpuclk_step_khz(mStep) == acpuclk_get_rate())
+			break;
+	}
+
+	Status = gBS->LocateProtocol(&gHtcLeoInterruptControlProtocolGuid, NULL, (VOID **)&mIrqControl);
+	if (EFI_ERROR(Status)) {
+		DEBUG((EFI_D_ERROR, "AcpuGovernor: no idle statistics, staying at %d kHz\n", acpuclk_get_rate()));
+		return Status;
+	}
+	mIrqControl->GetIdleStats(&mLastIdle, &mLastTicks);
+
+	Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK, GovUpdate, NULL, &mGovTimer);
+	ASSERT_EFI_ERROR(Status);
+
+	Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, GovUpdate, NULL, &mGovKick);
+	ASSERT_EFI_ERROR(Status);
+
+	Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY, GovExitBootServices, NULL, &mGovExitBootServices);
+	ASSERT_EFI_ERROR(Status);
+
+	// 0 keeps the boot speed, pinning is then a no-op
+	if (PeriodMs != 0)
+		gBS->SetTimer(mGovTimer, TimerPeriodic, EFI_TIMER_PERIOD_MILLISECONDS(PeriodMs));
+
+	Status = gBS->InstallMultipleProtocolInterfaces(
+		&Handle, &gHtcLeoCpuFreqProtocolGuid, &gHtcLeoCpuFreqProtocol, NULL);
+	ASSERT_EFI_ERROR(Status);
+
+	return Status;
+}
@@ -27,47 +27,302 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/pcom.h>
 #include <Library/acpuclock.h>
+#include <Library/reg.h>
 
 #include <Chipset/iomap.h>
 #include <Chipset/clock.h>
 
 #include <Protocol/EmbeddedClock.h>
 
-static UINTN ClocksLookup[NR_CLKS];
+// AcpuGovernor.c
+EFI_STATUS AcpuGovernorInit(VOID);
+
+/*
+ * Clock tree model. The modem is only asked when a clock really changes:
+ * enables are reference counted, parents are held on while a child is,
+ * and the selected speed and the rate read back are cached. Everything
+ * is guarded by TPL_CALLBACK, the modem round trips can take a while and
+ * must not hold off notify level events. Callers above it keep their TPL.
+ *
+ * Clocks with an M/N:D counter owned by the application processor are
+ * programmed directly through their NS/MD registers, any rate the
+ * counter can make is reachable without asking the modem.
+ */
+typedef struct {
+	INTN PcomId;		// modem clock id, -1 if the modem doesn't know it
+	INTN RpcId;		// PCOM_CLKCTL_RPC_* clock id for clocks the regime calls lack, -1 if none
+	UINTN Parent;		// held enabled while this clock is, NR_CLKS if none
+	UINTN RefCount;
+	UINTN Speed;		// last PCOM_CLK_REGIME_SEC_SEL_SPEED index, 0 unknown
+	UINTN Rate;		// Hz, 0 unknown
+	UINT32 NsReg;		// native M/N:D counter, 0 if none
+	UINT32 MdReg;
+} MSM_CLOCK;
+
+static MSM_CLOCK mClocks[NR_CLKS];
+
+STATIC VOID
+ClockSet(UINTN Id, INTN PcomId, UINTN Parent)
+{
+	mClocks[Id].PcomId = PcomId;
+	mClocks[Id].Parent = Parent;
+}
+
+STATIC VOID
+ClockSetRpc(UINTN Id, INTN RpcId, UINTN Parent)
+{
+	mClocks[Id].RpcId = RpcId;
+	mClocks[Id].Parent = Parent;
+}
+
+// Clocks nobody can switch are left alone
+#define CLOCK_UNKNOWN(Clk)	((Clk)->PcomId == -1 && (Clk)->RpcId == -1 && (Clk)->NsReg == 0)
+
+STATIC VOID
+ClockSetMnd(UINTN Id, UINT32 NsReg, UINT32 MdReg)
+{
+	mClocks[Id].NsReg = NsReg;
+	mClocks[Id].MdReg = MdReg;
+}
 
 VOID
 FillClocksLookup()
 {
-  // Fill struct with default values
-  for (UINTN i = 0; i < NR_CLKS; i++) {
-    ClocksLookup[i] = -1;
-  }
-
-  // Fill used clocks
-  ClocksLookup[ICODEC_RX_CLK] = 50;
-  ClocksLookup[ICODEC_TX_CLK] = 52;
-  ClocksLookup[ECODEC_CLK] = 42;
-  ClocksLookup[SDAC_MCLK] = 64;
-  ClocksLookup[IMEM_CLK] = 55;
-  ClocksLookup[GRP_CLK] = 56;
-  ClocksLookup[ADM_CLK] = 19;
-  ClocksLookup[UART1DM_CLK] = 78;
-  ClocksLookup[UART2DM_CLK] = 80;
-  ClocksLookup[VFE_AXI_CLK] = 24;
-  ClocksLookup[VFE_MDC_CLK] = 40;
-  ClocksLookup[VFE_CLK] = 41;
-  ClocksLookup[MDC_CLK] = 53;
-  ClocksLookup[SPI_CLK] = 95;
-  ClocksLookup[MDP_CLK] = 9;
-  ClocksLookup[SDC1_CLK] = 66;
-  ClocksLookup[SDC2_CLK] = 67;
-  ClocksLookup[SDC1_PCLK] = 17;
-  ClocksLookup[SDC2_PCLK] = 16;
+	// Fill struct with default values
+	for (UINTN i = 0; i < NR_CLKS; i++) {
+		ZeroMem(&mClocks[i], sizeof(mClocks[i]));
+		ClockSet(i, -1, NR_CLKS);
+		mClocks[i].RpcId = -1;
+	}
+
+	// Fill used clocks
+	ClockSet(ICODEC_RX_CLK, 50, NR_CLKS);
+	ClockSet(ICODEC_TX_CLK, 52, NR_CLKS);
+	ClockSet(ECODEC_CLK, 42, NR_CLKS);
+	ClockSet(SDAC_MCLK, 64, NR_CLKS);
+	ClockSet(IMEM_CLK, 55, NR_CLKS);
+	ClockSet(GRP_CLK, 56, NR_CLKS);
+	ClockSet(ADM_CLK, 19, NR_CLKS);
+	ClockSet(UART1DM_CLK, 78, NR_CLKS);
+	ClockSet(UART2DM_CLK, 80, NR_CLKS);
+	ClockSet(VFE_AXI_CLK, 24, NR_CLKS);
+	ClockSet(VFE_MDC_CLK, 40, NR_CLKS);
+	ClockSet(VFE_CLK, 41, VFE_AXI_CLK);
+	ClockSet(MDC_CLK, 53, NR_CLKS);
+	ClockSet(SPI_CLK, 95, NR_CLKS);
+	ClockSet(MDP_CLK, 9, NR_CLKS);
+	// The core clocks are useless without the bus interface
+	ClockSet(SDC1_CLK, 66, SDC1_PCLK);
+	ClockSet(SDC2_CLK, 67, SDC2_PCLK);
+	ClockSet(SDC1_PCLK, 17, NR_CLKS);
+	ClockSet(SDC2_PCLK, 16, NR_CLKS);
+
+	// Not reachable through the clock regime calls
+	ClockSetRpc(I2C_CLK, PCOM_I2C_CLK, NR_CLKS);
+	ClockSetRpc(LCDC_PAD_PCLK, PCOM_MDP_LCDC_PAD_PCLK_CLK, NR_CLKS);
+	// The pixel clock is useless without the pad clock
+	ClockSetRpc(LCDC_PCLK, PCOM_MDP_LCDC_PCLK_CLK, LCDC_PAD_PCLK);
+
+	// Rates set natively, enables of clocks the modem knows still go there
+	ClockSetMnd(SDC1_CLK, SDC1_NS_REG, SDC1_MD_REG);
+	ClockSetMnd(SDC2_CLK, SDC2_NS_REG, SDC2_MD_REG);
+	ClockSetMnd(SDC3_CLK, SDC3_NS_REG, SDC3_MD_REG);
+	ClockSetMnd(SDC4_CLK, SDC4_NS_REG, SDC4_MD_REG);
+}
+
+STATIC EFI_TPL
+ClockLock(VOID)
+{
+	EFI_TPL Tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+
+	gBS->RestoreTPL(Tpl);
+	return gBS->RaiseTPL(MAX(Tpl, TPL_CALLBACK));
+}
+
+STATIC EFI_STATUS
+ClkSelectSpeedLocked(UINTN Id, UINTN Speed)
+{
+	MSM_CLOCK *Clk = &mClocks[Id];
+	UINT32 PcomId = Clk->PcomId;
+
+	if (Clk->Speed == Speed)
+		return EFI_SUCCESS;
+
+	// The rate is read back lazily once somebody asks for it
+	Clk->Rate = 0;
+	if (msm_proc_comm(PCOM_CLK_REGIME_SEC_SEL_SPEED, &PcomId, &Speed)) {
+		Clk->Speed = 0;
+		return EFI_DEVICE_ERROR;
+	}
+
+	Clk->Speed = Speed;
+	return EFI_SUCCESS;
+}
+
+/*
+ * M/N:D counters: rate = src / pre_div * M / N with 8 bit M and N.
+ * Layout as in the SDC MCLK settings, e.g. 0x00580B49/0x0019003F for
+ * 768 MHz / 2 * 25 / 192 = 50 MHz.
+ */
+#define NS_N_MINUS_M(m, n)	((~((n) - (m)) & 0xFF) << 16)
+#define NS_ROOT_EN			(1 << 11)
+#define NS_BRANCH_EN		(1 << 9)
+#define NS_MND_EN			(1 << 8)
+#define NS_MND_RESET		(1 << 7)
+#define NS_MND_DUAL_EDGE	(2 << 5)
+#define NS_PRE_DIV(d)		(((d) - 1) << 3)
+#define NS_SRC_MASK			0x7
+#define MD8(m, n)			(((m) << 16) | (~(n) & 0xFF))
+
+#define MND_MAX				255
+#define MND_PRE_DIV_MAX		4
+
+// Counter inputs above this are not used, like the known good settings
+#define MND_INPUT_MAX_HZ	384000000
+
+typedef struct {
+	UINT32 Sel;
+	UINT32 Hz;
+} MND_SOURCE;
+
+STATIC CONST MND_SOURCE mMndSources[] = {
+	{ 0, 19200000 },	/* TCXO */
+	{ 1, 768000000 },	/* Global PLL */
+};
+
+typedef struct {
+	UINT32 Sel;
+	UINT32 PreDiv;
+	UINT32 M;
+	UINT32 N;
+	UINT32 Hz;
+} MND_CONFIG;
+
+/*
+ * Finds the highest rate not above Rate, exact if possible. Among
+ * settings giving the same rate the smallest N wins, it has the least
+ * jitter.
+ */
+STATIC BOOLEAN
+MndSolve(UINT32 Rate, MND_CONFIG *Best)
+{
+	UINT32 Base, M, N, D, Hz;
+	UINTN s;
+
+	Best->Hz = 0;
+	for (s = 0; s < ARRAY_SIZE(mMndSources); s++) {
+		for (D = 1; D <= MND_PRE_DIV_MAX; D++) {
+			Base = mMndSources[s].Hz / D;
+			if (Base > MND_INPUT_MAX_HZ)
+				continue;
+
+			for (N = 1; N <= MND_MAX; N++) {
+				M = (UINT32)DivU64x32(MultU64x32(Rate, N), Base);
+				if (M == 0)
+					continue;
+				// M == N bypasses the counter
+				M = MIN(M, N);
+
+				Hz = (UINT32)DivU64x32(MultU64x32(Base, M), N);
+				if (Hz > Best->Hz || (Hz == Best->Hz && N < Best->N)) {
+					Best->Sel = mMndSources[s].Sel;
+					Best->PreDiv = D;
+					Best->M = M;
+					Best->N = N;
+					Best->Hz = Hz;
+				}
+				if (M == N)
+					break;
+			}
+		}
+	}
+
+	return Best->Hz != 0;
+}
+
+STATIC UINT32
+MndDecode(UINT32 Ns, UINT32 Md)
+{
+	UINT32 Base = 0, M, N;
+	UINTN s;
+
+	for (s = 0; s < ARRAY_SIZE(mMndSources); s++) {
+		if (mMndSources[s].Sel == (Ns & NS_SRC_MASK))
+			Base = mMndSources[s].Hz;
+	}
+	Base /= ((Ns >> 3) & 0x3) + 1;
+
+	if (!(Ns & NS_MND_EN))
+		return Base;
+
+	M = (Md >> 16) & 0xFF;
+	N = ((~Ns >> 16) & 0xFF) + M;
+	if (M == 0 || N == 0)
+		return 0;
+
+	return (UINT32)DivU64x32(MultU64x32(Base, M), N);
 }
 
+STATIC EFI_STATUS
+ClkMndSetRateLocked(UINTN Id, UINTN Rate)
+{
+	MSM_CLOCK *Clk = &mClocks[Id];
+	MND_CONFIG Cfg;
+	UINT32 Ns, Md, Cur, En;
+
+	if (!MndSolve(Rate, &Cfg))
+		return EFI_UNSUPPORTED;
+
+	Ns = Cfg.Sel | NS_PRE_DIV(Cfg.PreDiv);
+	Md = 0;
+	if (Cfg.M != Cfg.N) {
+		Ns |= NS_N_MINUS_M(Cfg.M, Cfg.N) | NS_MND_DUAL_EDGE | NS_MND_EN;
+		Md = MD8(Cfg.M, Cfg.N);
+	}
+
+	Cur = readl(Clk->NsReg);
+	En = Cur & (NS_ROOT_EN | NS_BRANCH_EN);
+
+	if ((Cur & ~(NS_ROOT_EN | NS_BRANCH_EN)) != Ns ||
+	    (Md != 0 && readl(Clk->MdReg) != Md)) {
+		// Counter held in reset while M/N change, as clock_config() does
+		writel(Cur | NS_MND_RESET, Clk->NsReg);
+		if (Md != 0)
+			writel(Md, Clk->MdReg);
+		writel(Ns | En | NS_MND_RESET, Clk->NsReg);
+		writel(Ns | En, Clk->NsReg);
+	}
+
+	Clk->Rate = Cfg.Hz;
+	// Whatever the modem selected last is gone
+	Clk->Speed = 0;
+
+	if (Cfg.Hz != Rate)
+		DEBUG((EFI_D_INFO, "ClockDxe: clock %d at %d Hz for %d Hz\n", Id, Cfg.Hz, Rate));
+
+	return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS
+ClkRpcSetRateLocked(UINTN Id, UINTN Rate)
+{
+	MSM_CLOCK *Clk = &mClocks[Id];
+	UINT32 RpcId = Clk->RpcId;
+	UINT32 Hz = Rate;
+
+	if (Clk->Rate == Rate)
+		return EFI_SUCCESS;
+
+	Clk->Rate = 0;
+	if (msm_proc_comm(PCOM_CLKCTL_RPC_SET_RATE, &RpcId, &Hz))
+		return EFI_DEVICE_ERROR;
+
+	// Read back lazily, the modem may round it
+	return EFI_SUCCESS;
+}
 
 // Cotullaz "new" clock functions
-UINTN
+STATIC EFI_STATUS
 CotullaClkSetRate(UINT32 Id, UINTN Rate)
 {
 	// TODO?
@@ -152,7 +407,7 @@ CotullaClkSetRate(UINT32 Id, UINTN Rate)
 			else if (Rate == 12000000) 	Speed = 14;
 			else if (Rate ==  6000000) 	Speed = 6;
 			else if (Rate ==  3000000) 	Speed = 1;
-			else return 0;
+			else return EFI_SUCCESS;
 			break;
 		case VFE_CLK:
 			if (Rate == 36000000) 		Speed = 1;
@@ -160,7 +415,7 @@ CotullaClkSetRate(UINT32 Id, UINTN Rate)
 			else if (Rate == 64000000) 	Speed = 3;
 			else if (Rate == 78000000) 	Speed = 4;
 			else if (Rate == 96000000) 	Speed = 5;
-			else return 0;
+			else return EFI_SUCCESS;
 			break;
 		case SPI_CLK:
 			if (Rate > 15360000) 		Speed = 5;
@@ -203,69 +458,187 @@ CotullaClkSetRate(UINT32 Id, UINTN Rate)
 			break;
 		case SDC1_PCLK:
 		case SDC2_PCLK:
-			return 0;
+			return EFI_SUCCESS;
 			break;
 		default:
-			return -1;  
+			return EFI_UNSUPPORTED;
     }
-    msm_proc_comm(PCOM_CLK_REGIME_SEC_SEL_SPEED, &ClocksLookup[Id], &Speed);
-	
-    return 0;
+    return ClkSelectSpeedLocked(Id, Speed);
 }
 
 /* note: used in lcdc */
 EFI_STATUS
 ClkSetRate(UINTN Id, UINTN Freq)
 {
-	UINT32 Retval = 0;
-  	Retval = CotullaClkSetRate(Id, Freq);
-	if (Retval != -1)
-		return Retval;
-		
-	return -1;
+	EFI_TPL OldTpl;
+	EFI_STATUS Status;
+
+	if (Id >= NR_CLKS)
+		return EFI_INVALID_PARAMETER;
+
+	OldTpl = ClockLock();
+	if (mClocks[Id].NsReg != 0)
+		Status = ClkMndSetRateLocked(Id, Freq);
+	else if (mClocks[Id].PcomId == -1 && mClocks[Id].RpcId != -1)
+		Status = ClkRpcSetRateLocked(Id, Freq);
+	else
+		Status = CotullaClkSetRate(Id, Freq);
+	gBS->RestoreTPL(OldTpl);
+
+	return Status;
 }
 
 UINTN
-ClkGetRate(UINT32 Id)
+ClkGetRate(UINTN Id)
 {
-	UINTN Rate = 0;
+	MSM_CLOCK *Clk;
+	EFI_TPL OldTpl;
+	UINT32 PcomId, Khz = 0;
+	UINTN Rate;
 
-	if (ClocksLookup[Id] != -1) {
-		msm_proc_comm(PCOM_CLK_REGIME_SEC_MSM_GET_CLK_FREQ_KHZ, &ClocksLookup[Id], &Rate);
-		return Rate;
-	}
-	else {
+	if (Id >= NR_CLKS)
+		return 0;
+
+	Clk = &mClocks[Id];
+	if (CLOCK_UNKNOWN(Clk)) {
 		switch(Id) {
 		/*case USB_OTG_CLK:
 					Rate = get_mdns_host_clock(Id);
 					break;*/
 		case SDC4_PCLK:
 			/* Hardcoded rate */
-			Rate = 64000000;
-			break;
+			return 64000000;
 		default:
-			Rate = -1;
+			return 0;
 		}
 	}
+
+	OldTpl = ClockLock();
+	if (Clk->Rate == 0 && Clk->NsReg != 0) {
+		Clk->Rate = MndDecode(readl(Clk->NsReg), readl(Clk->MdReg));
+	} else if (Clk->Rate == 0 && Clk->PcomId == -1) {
+		// The RPC calls already answer in Hz
+		PcomId = Clk->RpcId;
+		if (msm_proc_comm(PCOM_CLKCTL_RPC_RATE, &PcomId, 0) == 0)
+			Clk->Rate = PcomId;
+	} else if (Clk->Rate == 0) {
+		PcomId = Clk->PcomId;
+		if (msm_proc_comm(PCOM_CLK_REGIME_SEC_MSM_GET_CLK_FREQ_KHZ, &PcomId, &Khz) == 0)
+			Clk->Rate = Khz * 1000;
+	}
+	Rate = Clk->Rate;
+	gBS->RestoreTPL(OldTpl);
+
 	return Rate;
 }
 
-UINTN
+STATIC VOID ClkDisableLocked(UINTN Id);
+
+STATIC EFI_STATUS
+ClkEnableLocked(UINTN Id)
+{
+	MSM_CLOCK *Clk = &mClocks[Id];
+	EFI_STATUS Status;
+	UINT32 PcomId;
+	UINT32 Cmd = PCOM_CLK_REGIME_SEC_ENABLE;
+
+	if (CLOCK_UNKNOWN(Clk))
+		return EFI_UNSUPPORTED;
+
+	if (Clk->RefCount++ > 0)
+		return EFI_SUCCESS;
+
+	if (Clk->Parent != NR_CLKS) {
+		Status = ClkEnableLocked(Clk->Parent);
+		if (EFI_ERROR(Status)) {
+			Clk->RefCount--;
+			return Status;
+		}
+	}
+
+	if (Clk->PcomId == -1 && Clk->RpcId == -1) {
+		writel(readl(Clk->NsReg) | NS_ROOT_EN | NS_BRANCH_EN, Clk->NsReg);
+		return EFI_SUCCESS;
+	}
+
+	PcomId = Clk->PcomId;
+	if (Clk->PcomId == -1) {
+		Cmd = PCOM_CLKCTL_RPC_ENABLE;
+		PcomId = Clk->RpcId;
+	}
+	if (msm_proc_comm(Cmd, &PcomId, 0)) {
+		DEBUG((EFI_D_ERROR, "ClockDxe: enabling clock %d failed\n", Id));
+		Clk->RefCount--;
+		if (Clk->Parent != NR_CLKS)
+			ClkDisableLocked(Clk->Parent);
+		return EFI_DEVICE_ERROR;
+	}
+
+	return EFI_SUCCESS;
+}
+
+STATIC VOID
+ClkDisableLocked(UINTN Id)
+{
+	MSM_CLOCK *Clk = &mClocks[Id];
+	UINT32 PcomId;
+	UINT32 Cmd = PCOM_CLK_REGIME_SEC_DISABLE;
+
+	if (CLOCK_UNKNOWN(Clk))
+		return;
+
+	if (Clk->RefCount == 0) {
+		DEBUG((EFI_D_ERROR, "ClockDxe: unbalanced disable of clock %d\n", Id));
+		return;
+	}
+
+	if (--Clk->RefCount > 0)
+		return;
+
+	if (Clk->PcomId == -1 && Clk->RpcId == -1) {
+		writel(readl(Clk->NsReg) & ~NS_BRANCH_EN, Clk->NsReg);
+		writel(readl(Clk->NsReg) & ~NS_ROOT_EN, Clk->NsReg);
+	} else {
+		PcomId = Clk->PcomId;
+		if (Clk->PcomId == -1) {
+			Cmd = PCOM_CLKCTL_RPC_DISABLE;
+			PcomId = Clk->RpcId;
+		}
+		if (msm_proc_comm(Cmd, &PcomId, 0))
+			DEBUG((EFI_D_ERROR, "ClockDxe: disabling clock %d failed\n", Id));
+	}
+
+	if (Clk->Parent != NR_CLKS)
+		ClkDisableLocked(Clk->Parent);
+}
+
+EFI_STATUS
 ClkEnable(UINTN Id)
 {
-	if (ClocksLookup[Id] != -1) {
-    	msm_proc_comm(PCOM_CLK_REGIME_SEC_ENABLE, &ClocksLookup[Id], 0);
-    	return ClocksLookup[Id];
-  	}
-	return -1;
+	EFI_TPL OldTpl;
+	EFI_STATUS Status;
+
+	if (Id >= NR_CLKS)
+		return EFI_INVALID_PARAMETER;
+
+	OldTpl = ClockLock();
+	Status = ClkEnableLocked(Id);
+	gBS->RestoreTPL(OldTpl);
+
+	return Status;
 }
 
 VOID
 ClkDisable(UINTN Id)
 {
-	if (ClocksLookup[Id] != -1) {
-		msm_proc_comm(PCOM_CLK_REGIME_SEC_DISABLE, &ClocksLookup[Id], 0);
-	}
+	EFI_TPL OldTpl;
+
+	if (Id >= NR_CLKS)
+		return;
+
+	OldTpl = ClockLock();
+	ClkDisableLocked(Id);
+	gBS->RestoreTPL(OldTpl);
 }
 
 int msm_pll_request(unsigned id, unsigned on)
@@ -281,6 +654,7 @@ EMBEDDED_CLOCK_PROTOCOL  gClock = {
   ClkEnable,
   ClkDisable,
   ClkSetRate,
+  ClkGetRate,
 };
 
 EFI_STATUS
@@ -303,6 +677,9 @@ ClockDxeInitialize(
 	// Setup Scorpion PLL
 	msm_acpu_clock_init(11+6);
 
+	// Boot runs at the top step, the governor scales down once idle
+	AcpuGovernorInit();
+
 	// Install the Embedded Clock Protocol onto a new handle
 	Handle = NULL;
 	Status = gBS->InstallMultipleProtocolInterfaces (
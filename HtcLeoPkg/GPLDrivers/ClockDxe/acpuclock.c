@@ -18,8 +18,10 @@
 #include <Library/LKEnvLib.h>
 #include <Chipset/iomap.h>
 #include <Chipset/clock.h>
+#include <Chipset/timer.h>
 #include <Library/acpuclock.h>
 #include <Library/TimerLib.h>
+#include <Library/PcdLib.h>
 
 unsigned acpuclk_init_done = 0;
 
@@ -44,6 +46,22 @@ unsigned acpuclk_init_done = 0;
 #define SRC_RAW		0 /* clock from SPSS_CLK_CNTL */
 #define SRC_SCPLL	1 /* output of scpll 128-998 MHZ */
 
+#define SCPLL_STATUS_SWITCH	0x1 /* frequency switch in progress */
+#define SCPLL_STATUS_CAL	0x2 /* calibration in progress */
+
+/* Lock takes a few us, anything past this is a wedged PLL */
+#define SCPLL_TIMEOUT_US	200
+/* Same bound in status reads, for when the DGT is not running */
+#define SCPLL_TIMEOUT_POLLS	100000
+
+/* Largest jump the SCPLL slews in place without dropping to the MPLL */
+#define SCPLL_MAX_HOP_KHZ	256000
+/* The vendor kernel lets the output settle this long after an in-place hop */
+#define SCPLL_HOP_SETTLE_US	100
+
+#define DGT_TICKS_PER_US	(DGT_HZ / 1000000)
+#define DGT_TICKS_TO_NS(t)	(((UINT64)(t) * 625) / 3)
+
 /* Set rate and enable the clock */
 void clock_config(UINT32 ns, UINT32 md, UINT32 ns_addr, UINT32 md_addr)
 {
@@ -119,6 +137,12 @@ struct clkctl_acpu_speed *acpu_stby = &acpu_freq_tbl[0];
 struct clkctl_acpu_speed *acpu_mpll = &acpu_freq_tbl[0];
 struct clkctl_acpu_speed *current_speed = NULL;
 
+/* AXI/EBI1 floor currently voted to the modem, 0 if none */
+static unsigned axi_vote_khz = 0;
+
+/* Transition latency into each acpu_freq_tbl entry */
+static struct acpuclk_step_stats step_stats[ARRAY_SIZE(acpu_freq_tbl) - 1];
+
 #define IS_ACPU_STANDBY(x)	(((x)->clk_cfg == acpu_stby->clk_cfg) && ((x)->clk_sel == acpu_stby->clk_sel))
 
 #define PLLMODE_POWERDOWN	0
@@ -130,12 +154,64 @@ struct clkctl_acpu_speed *current_speed = NULL;
 #define PLLMODE_NORMAL		7
 #define PLLMODE_MASK		7
 
-static void scpll_power_down(void)
+/*
+ * TimerDxe runs the DGT at 4.8 MHz and clears it on match, so a distance
+ * between two samples has to account for one period wrap. Before TimerDxe
+ * starts it, or while the timer is off, the DGT stands still.
+ */
+static int dgt_running(void)
+{
+	return readl(DGT_ENABLE) & DGT_ENABLE_EN;
+}
+
+static UINT32 dgt_ticks_since(UINT32 start)
+{
+	UINT32 end = readl(DGT_COUNT_VAL);
+
+	if (end >= start)
+		return end - start;
+	return end + readl(DGT_MATCH_VAL) + 1 - start;
+}
+
+/* The GPT behind MicroSecondDelay() ticks at 32 kHz, too coarse for this */
+static void acpu_udelay(unsigned us)
+{
+	UINT32 start;
+
+	if (!dgt_running()) {
+		MicroSecondDelay(us);
+		return;
+	}
+
+	start = readl(DGT_COUNT_VAL);
+	while (dgt_ticks_since(start) < us * DGT_TICKS_PER_US);
+}
+
+/* Poll the SCPLL status until the mask bits clear, -1 if they never do */
+static int scpll_wait(UINT32 mask)
+{
+	UINT32 start = readl(DGT_COUNT_VAL);
+	int timed = dgt_running();
+	unsigned polls = 0;
+
+	while (readl(SCPLL_STATUS_ADDR) & mask) {
+		if (timed ? dgt_ticks_since(start) > SCPLL_TIMEOUT_US * DGT_TICKS_PER_US
+		          : ++polls > SCPLL_TIMEOUT_POLLS) {
+			dprintf(CRITICAL, "[ACPU] SCPLL stuck, status 0x%x\n", readl(SCPLL_STATUS_ADDR));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int scpll_power_down(void)
 {
 	UINT32 val;
 
 	/* Wait for any frequency switches to finish. */
-	while (readl(SCPLL_STATUS_ADDR) & 0x1);
+	if (scpll_wait(SCPLL_STATUS_SWITCH))
+		return -1;
 
 	/* put the pll in standby mode */
 	val = readl(SCPLL_CTL_ADDR);
@@ -144,24 +220,63 @@ static void scpll_power_down(void)
 	dmb();
 
 	/* wait to stabilize in standby mode */
-	NanoSecondDelay(10);
+	acpu_udelay(10);
 
 	val = (val & (~PLLMODE_MASK)) | PLLMODE_POWERDOWN;
 	writel(val, SCPLL_CTL_ADDR);
 	dmb();
+
+	return 0;
 }
 
-static void scpll_set_freq(UINT32 lval)
+static int scpll_is_normal(void)
 {
-	UINT32 val, ctl;
+	return (readl(SCPLL_CTL_ADDR) & PLLMODE_MASK) == PLLMODE_NORMAL;
+}
 
+static UINT32 scpll_clamp_l(UINT32 lval)
+{
 	if (lval > 33)
 		lval = 33;
 	if (lval < 10)
 		lval = 10;
+	return lval;
+}
+
+/*
+ * Slew a running SCPLL to a new L value. Running the CPU from it meanwhile
+ * is only done behind PcdAcpuScpllInPlaceHop, it is not verified here.
+ */
+static int scpll_hop(UINT32 lval)
+{
+	UINT32 val, ctl;
+
+	/* wait for any calibrations or frequency switches to finish */
+	if (scpll_wait(SCPLL_STATUS_SWITCH | SCPLL_STATUS_CAL))
+		return -1;
+
+	/* write the new L val and switch mode */
+	val = readl(SCPLL_FSM_CTL_EXT_ADDR);
+	val = (val & (~0x1FF)) | (scpll_clamp_l(lval) << 3) | HOP_SWITCH;
+	writel(val, SCPLL_FSM_CTL_EXT_ADDR);
+	dmb();
+
+	ctl = readl(SCPLL_CTL_ADDR);
+	writel(ctl | PLLMODE_NORMAL, SCPLL_CTL_ADDR);
+	dmb();
+
+	/* wait for frequency switch to finish */
+	return scpll_wait(SCPLL_STATUS_SWITCH);
+}
+
+/* Full relock from standby or power down, the CPU must not run from it */
+static int scpll_set_freq(UINT32 lval)
+{
+	UINT32 val, ctl;
 
 	/* wait for any calibrations or frequency switches to finish */
-	while (readl(SCPLL_STATUS_ADDR) & 0x3);
+	if (scpll_wait(SCPLL_STATUS_SWITCH | SCPLL_STATUS_CAL))
+		return -1;
 
 	ctl = readl(SCPLL_CTL_ADDR);
 
@@ -171,7 +286,7 @@ static void scpll_set_freq(UINT32 lval)
 		dmb();
 
 		/* wait to stabilize in standby mode */
-		NanoSecondDelay(10);
+		acpu_udelay(10);
 
 		/* switch to 384 MHz */
 		val = readl(SCPLL_FSM_CTL_EXT_ADDR);
@@ -184,24 +299,14 @@ static void scpll_set_freq(UINT32 lval)
 		dmb();
 
 		/* wait for frequency switch to finish */
-		while (readl(SCPLL_STATUS_ADDR) & 0x1) ;
+		if (scpll_wait(SCPLL_STATUS_SWITCH))
+			return -1;
 
 		/* completion bit is not reliable for SHOT switch */
-		NanoSecondDelay(25);
+		acpu_udelay(25);
 	}
 
-	/* write the new L val and switch mode */
-	val = readl(SCPLL_FSM_CTL_EXT_ADDR);
-	val = (val & (~0x1FF)) | (lval << 3) | HOP_SWITCH;
-	writel(val, SCPLL_FSM_CTL_EXT_ADDR);
-	dmb();
-
-	ctl = readl(SCPLL_CTL_ADDR);
-	writel(ctl | PLLMODE_NORMAL, SCPLL_CTL_ADDR);
-	dmb();
-
-	/* wait for frequency switch to finish */
-	while (readl(SCPLL_STATUS_ADDR) & 0x1) ;
+	return scpll_hop(lval);
 }
 
 /* this is still a bit weird... */
@@ -229,9 +334,77 @@ static void select_clock(unsigned src, unsigned config)
 	writel(val | ((src & 3) << 1), SPSS_CLK_SEL_ADDR);
 }
 
+/*
+ * EBI1 is a min/max clock on the modem side, a plain set_rate is refused.
+ * The floor is the vote, the modem may run the bus faster for others.
+ */
+static int acpuclk_set_axi_rate(unsigned khz)
+{
+	unsigned id = PCOM_EBI1_CLK;
+	unsigned hz = khz * 1000;
+
+	if (khz == axi_vote_khz)
+		return 0;
+
+	if (msm_proc_comm(PCOM_CLKCTL_RPC_MIN_RATE, &id, &hz)) {
+		dprintf(CRITICAL, "[ACPU] AXI vote for %d kHz failed\n", khz);
+		axi_vote_khz = 0;
+		return -1;
+	}
+
+	axi_vote_khz = khz;
+	return 0;
+}
+
+unsigned long acpuclk_get_axi_rate(void)
+{
+	return axi_vote_khz;
+}
+
+/* Both on the SCPLL, locked, and close enough to slew without a relock */
+static int acpuclk_can_hop(struct clkctl_acpu_speed *cur, struct clkctl_acpu_speed *next)
+{
+	unsigned delta;
+
+	if (!FixedPcdGetBool(PcdAcpuScpllInPlaceHop))
+		return 0;
+	if (cur->clk_sel != SRC_SCPLL || next->clk_sel != SRC_SCPLL)
+		return 0;
+	if (((readl(SPSS_CLK_SEL_ADDR) & 6) >> 1) != SRC_SCPLL || !scpll_is_normal())
+		return 0;
+
+	delta = next->acpu_khz > cur->acpu_khz ? next->acpu_khz - cur->acpu_khz
+	                                       : cur->acpu_khz - next->acpu_khz;
+	return delta <= SCPLL_MAX_HOP_KHZ;
+}
+
+static void acpuclk_account(struct clkctl_acpu_speed *next, int hop, int failed,
+                            int timed, UINT32 start)
+{
+	struct acpuclk_step_stats *stats = &step_stats[next - acpu_freq_tbl];
+	UINT32 ns;
+
+	stats->switches++;
+	if (hop)
+		stats->hops++;
+	if (failed)
+		stats->failures++;
+	if (!timed)
+		return;
+
+	ns = (UINT32)DGT_TICKS_TO_NS(dgt_ticks_since(start));
+	stats->timed++;
+	stats->last_ns = ns;
+	stats->total_ns += ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+}
+
 int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason)
 {
-	struct clkctl_acpu_speed *cur, *next;
+	struct clkctl_acpu_speed *cur, *next, *target;
+	UINT32 start;
+	int timed, hop = 0, ret = 0;
 
 	cur = current_speed;
 
@@ -252,12 +425,30 @@ int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason)
 		next++;
 	}
 
-	if (next->clk_sel == SRC_SCPLL) {
+	/* The bus goes up before the CPU so it is never starved on the way */
+	if (reason == SETRATE_CPUFREQ && next->axiclk_khz > cur->axiclk_khz)
+		acpuclk_set_axi_rate(next->axiclk_khz);
+
+	/* The AXI vote is a proc_comm round trip, pcomstat accounts for it */
+	timed = dgt_running();
+	start = readl(DGT_COUNT_VAL);
+	target = next;
+
+	if (acpuclk_can_hop(cur, next) && scpll_hop(next->sc_l_value) == 0) {
+		/* curr -> target, the CPU keeps running from the SCPLL */
+		acpu_udelay(SCPLL_HOP_SETTLE_US);
+		hop = 1;
+	} else if (next->clk_sel == SRC_SCPLL) {
 		/* curr -> standby(MPLL speed) -> target */
 		if (!IS_ACPU_STANDBY(cur))
 			select_clock(acpu_stby->clk_sel, acpu_stby->clk_cfg);
-		scpll_set_freq(next->sc_l_value);
-		select_clock(SRC_SCPLL, 0);
+		if (scpll_set_freq(next->sc_l_value) == 0) {
+			select_clock(SRC_SCPLL, 0);
+		} else {
+			/* Stay on the MPLL, it is a table entry as well */
+			next = acpu_stby;
+			ret = -1;
+		}
 	} else {
 		if (cur->clk_sel == SRC_SCPLL) {
 			select_clock(acpu_stby->clk_sel, acpu_stby->clk_cfg);
@@ -268,16 +459,14 @@ int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason)
 		}
 	}
 
+	acpuclk_account(target, hop, ret, timed, start);
 	current_speed = next;
 
-/*	This will fail anyway, so remove it for now
-	if (reason == SETRATE_CPUFREQ) {
-		if (cur->axiclk_khz != next->axiclk_khz) 
-			clk_set_rate(EBI1_CLK, next->axiclk_khz * 1000);
-	}
-*/
+	/* ...and down only once the CPU has slowed */
+	if (reason == SETRATE_CPUFREQ && next->axiclk_khz < cur->axiclk_khz)
+		acpuclk_set_axi_rate(next->axiclk_khz);
 
-	return 0;
+	return ret;
 }
 
 static unsigned acpuclk_find_speed(void)
@@ -340,13 +529,32 @@ static void acpuclk_init(int freq_num)
 	 */
 	select_clock(acpu_stby->clk_sel, acpu_stby->clk_cfg);
 	scpll_power_down();
-	scpll_set_freq(current_speed->sc_l_value);
-	select_clock(SRC_SCPLL, 0);
+	if (scpll_set_freq(current_speed->sc_l_value) == 0) {
+		select_clock(SRC_SCPLL, 0);
+	} else {
+		dprintf(CRITICAL, "[ACPU] SCPLL did not lock, staying on the MPLL\n");
+		current_speed = acpu_stby;
+	}
 	acpuclk_init_done = 1;
 	
 	return;
 }
 
+unsigned acpuclk_step_khz(unsigned step)
+{
+	if (step >= ARRAY_SIZE(acpu_freq_tbl))
+		return 0;
+	return acpu_freq_tbl[step].acpu_khz;
+}
+
+int acpuclk_get_step_stats(unsigned step, struct acpuclk_step_stats *stats)
+{
+	if (step >= ARRAY_SIZE(step_stats))
+		return -1;
+	memcpy(stats, &step_stats[step], sizeof(*stats));
+	return 0;
+}
+
 unsigned long acpuclk_get_rate(void)
 {
 	return (acpuclk_init_done == 1 ? current_speed->acpu_khz : 998001);
@@ -362,5 +570,5 @@ void msm_acpu_clock_init(int freq_num)
 	drv_state.wait_for_irq_khz = 245000;
 */
 	acpuclk_init(freq_num);
-	//clk_set_rate(EBI1_CLK, drv_state.current_speed->axiclk_khz * 1000);
+	acpuclk_set_axi_rate(current_speed->axiclk_khz);
 }
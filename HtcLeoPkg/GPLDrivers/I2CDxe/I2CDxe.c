@@ -20,12 +20,15 @@
 #include <Uefi.h>
 #include <Library/DebugLib.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/TimerLib.h>
+#include <Library/BaseMemoryLib.h>
 
 #include <Library/pcom.h>
 #include <Library/gpio.h>
 #include <Library/LKEnvLib.h>
 #include <Library/reg.h>
 #include <Device/Gpio.h>
+#include <Device/microp.h>
 
 #include <Chipset/msm_i2c.h>
 #include <Chipset/iomap.h>
@@ -33,8 +36,10 @@
 #include <Chipset/clock.h>
 
 #include <Protocol/HardwareInterrupt.h>
+#include <Protocol/HtcLeoInterruptControl.h>
 #include <Protocol/EmbeddedClock.h>
 #include <Protocol/HtcLeoI2C.h>
+#include <Protocol/I2cMaster.h>
 
 #include <Chipset/gpio.h>
 #include <Chipset/irqs.h>
@@ -46,6 +51,8 @@ TLMM_GPIO *gGpio = NULL;
 EMBEDDED_CLOCK_PROTOCOL  *gClock = NULL;
 // Cached copy of the Hardware Interrupt protocol instance
 EFI_HARDWARE_INTERRUPT_PROTOCOL *gInterrupt = NULL;
+// Cached copy of the Interrupt Control protocol instance
+HTCLEO_INTERRUPT_CONTROL_PROTOCOL *gIrqControl = NULL;
 
 #define DEBUG_I2C 0
 
@@ -92,6 +99,156 @@ enum {
 static struct msm_i2c_dev dev;
 static int timeout;
 
+// Operations a single EFI_I2C_REQUEST_PACKET may carry
+#define I2C_MASTER_MAX_OPERATIONS	4
+// Requests with an event that may wait for the controller
+#define I2C_MASTER_MAX_QUEUED		4
+
+// An EFI_I2C_MASTER_PROTOCOL request completed through its event
+typedef struct {
+	struct i2c_msg	Msgs[I2C_MASTER_MAX_OPERATIONS];
+	int		Count;
+	int		Hz;
+	EFI_EVENT	Event;
+	EFI_STATUS	*I2cStatus;
+} I2C_MASTER_REQUEST;
+
+// Ring of queued requests, the head one is started first
+static I2C_MASTER_REQUEST mQueue[I2C_MASTER_MAX_QUEUED];
+static UINTN mQueueHead;
+static UINTN mQueueCount;
+// Queued request on the bus, NULL while a blocking caller owns it
+static I2C_MASTER_REQUEST *mCurrent;
+// Set while a transfer owns the controller
+static BOOLEAN mBusy;
+
+// Signalled by the ISR once dev.done is set
+static EFI_EVENT mXferDoneEvent;
+static EFI_EVENT mXferTimeoutEvent;
+// Twice the bus time of the transfer in flight, plus clock stretching slack
+static UINT64 mXferTimeoutNs;
+#define I2C_XFER_SLACK_NS		10000000ULL
+
+// The controller clock stays on this long after the last transfer
+#define I2C_CLK_IDLE_MS			20
+
+// Clock users, the clock is gated lazily from mClkIdleEvent
+static UINTN mClkRefs;
+static BOOLEAN mClkOn;
+static EFI_EVENT mClkIdleEvent;
+static EFI_EVENT mExitBootServicesEvent;
+
+static HTCLEO_I2C_STATS mStats;
+static UINT64 mXferStart;
+
+// Controller source clock (TCXO)
+#define I2C_SRC_CLK_HZ			19200000
+#define I2C_STANDARD_MODE_HZ		100000
+#define I2C_FAST_MODE_HZ		400000
+
+// Targets known to cope with fast mode, the rest runs at the bus default
+#define I2C_MAX_DEVICE_SPEEDS		8
+static struct {
+	uint16_t addr;
+	int hz;
+} i2c_dev_speed[I2C_MAX_DEVICE_SPEEDS] = {
+	{ MICROP_I2C_ADDR,		I2C_FAST_MODE_HZ },
+	{ DS2746_I2C_SLAVE_ADDR,	I2C_FAST_MODE_HZ },
+};
+
+// I2C_CLK_CTL currently programmed, -1 if unknown
+static int mClkCtl = -1;
+// Bus clock picked through EFI_I2C_MASTER_PROTOCOL.SetBusFrequency, 0 if none
+static int mMasterHz;
+
+static int msm_i2c_fs_div(int hz);
+static int msm_i2c_set_clock(int hz);
+
+/*
+ * Clock enables are proc_comm round trips to the modem, keep the clock
+ * running between back to back transfers and gate it once idle.
+ */
+static void msm_i2c_clk_get(void)
+{
+	EFI_TPL OldTpl;
+	BOOLEAN enable = FALSE;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	if (mClkRefs++ == 0 && !mClkOn) {
+		mClkOn = TRUE;
+		enable = TRUE;
+	}
+	gBS->RestoreTPL(OldTpl);
+
+	if (enable) {
+		gClock->ClkEnable(dev.pdata->clk_nr);
+		mStats.ClockEnables++;
+	}
+}
+
+static void msm_i2c_clk_put(void)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	ASSERT(mClkRefs > 0);
+	if (--mClkRefs == 0)
+		gBS->SetTimer(mClkIdleEvent, TimerRelative, EFI_TIMER_PERIOD_MILLISECONDS(I2C_CLK_IDLE_MS));
+	gBS->RestoreTPL(OldTpl);
+}
+
+STATIC
+VOID
+EFIAPI
+I2cClockIdleNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+	EFI_TPL OldTpl;
+	BOOLEAN disable = FALSE;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	if (mClkRefs == 0 && mClkOn) {
+		mClkOn = FALSE;
+		disable = TRUE;
+		// Do not trust the divider to survive the clock gate
+		mClkCtl = -1;
+	}
+	gBS->RestoreTPL(OldTpl);
+
+	if (disable)
+		gClock->ClkDisable(dev.pdata->clk_nr);
+}
+
+STATIC
+VOID
+EFIAPI
+I2cExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+	gBS->SetTimer(mClkIdleEvent, TimerCancel, 0);
+	gBS->SetTimer(mXferTimeoutEvent, TimerCancel, 0);
+	if (mClkOn) {
+		gClock->ClkDisable(dev.pdata->clk_nr);
+		mClkOn = FALSE;
+	}
+}
+
+static void msm_i2c_get_stats(HTCLEO_I2C_STATS *Stats, BOOLEAN Reset)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	if (Stats != NULL)
+		CopyMem(Stats, &mStats, sizeof(mStats));
+	if (Reset)
+		ZeroMem(&mStats, sizeof(mStats));
+	gBS->RestoreTPL(OldTpl);
+}
+
 #if DEBUG_I2C
 static void dump_status(uint32_t status)
 {
@@ -237,6 +394,8 @@ static void msm_i2c_interrupt_locked(void)
 		}
 		else if (!not_done && !dev.need_flush) {
 			timeout = 0;
+			dev.done = true;
+			gBS->SignalEvent(mXferDoneEvent);
 			return;
 		}
 	}
@@ -245,7 +404,11 @@ static void msm_i2c_interrupt_locked(void)
 out_err:
 	I2C_ERR("error, status %x\n", status);
 	dev.ret = ERROR;
+	dev.err_status = status;
+	dev.err_pos = dev.pos;
+	dev.done = true;
 	timeout = ERR_TIMED_OUT;
+	gBS->SignalEvent(mXferDoneEvent);
 }
 
 VOID
@@ -283,6 +446,8 @@ static int msm_i2c_recover_bus_busy(void)
 {
 	int i;
 	bool gpio_clk_status = false;
+	UINTN scl_bank, sda_bank;
+	UINT32 scl, sda;
 	uint32_t status = readl(dev.pdata->i2c_base + I2C_STATUS);
 	I2C_DBG_FUNC_LINE();
 
@@ -302,29 +467,39 @@ static int msm_i2c_recover_bus_busy(void)
 		writel(I2C_WRITE_DATA_LAST_BYTE | 0xff, dev.pdata->i2c_base + I2C_WRITE_DATA);
 	}
 
-	I2C_DBG(DEBUGLEVEL, "i2c_scl: %d, i2c_sda: %d\n", gGpio->Get(dev.pdata->scl_gpio), gGpio->Get(dev.pdata->sda_gpio));
+	gGpio->PinToBank(dev.pdata->scl_gpio, &scl_bank, &scl);
+	gGpio->PinToBank(dev.pdata->sda_gpio, &sda_bank, &sda);
+
+	// Open drain emulation: latch both outputs low and only toggle the
+	// direction, released lines are pulled up externally.
+	gGpio->BankDirection(scl_bank, scl, 0);
+	gGpio->BankDirection(sda_bank, sda, 0);
+	gGpio->BankWrite(scl_bank, scl, 0);
+	gGpio->BankWrite(sda_bank, sda, 0);
+
+	I2C_DBG(DEBUGLEVEL, "i2c_scl: %d, i2c_sda: %d\n", !!(gGpio->BankRead(scl_bank) & scl), !!(gGpio->BankRead(sda_bank) & sda));
 
 	for (i = 0; i < 9; i++) {
-		if (gGpio->Get(dev.pdata->sda_gpio) && gpio_clk_status)
+		if ((gGpio->BankRead(sda_bank) & sda) && gpio_clk_status)
 			break;
 			
-		gGpio->Set(dev.pdata->scl_gpio, 0);
+		gGpio->BankDirection(scl_bank, scl, scl);
 		NanoSecondDelay(5);
 		
-		gGpio->Set(dev.pdata->sda_gpio, 0);
+		gGpio->BankDirection(sda_bank, sda, sda);
 		NanoSecondDelay(5);
 		
-		gGpio->Config(dev.pdata->scl_gpio, GPIO_INPUT);
+		gGpio->BankDirection(scl_bank, scl, 0);
 		NanoSecondDelay(5);
 		
-		if (!gGpio->Get(dev.pdata->scl_gpio))
+		if (!(gGpio->BankRead(scl_bank) & scl))
 			NanoSecondDelay(20);
 			
-		if (!gGpio->Get(dev.pdata->scl_gpio))
+		if (!(gGpio->BankRead(scl_bank) & scl))
 			MicroSecondDelay(10);
 			
-		gpio_clk_status = gGpio->Get(dev.pdata->scl_gpio);
-		gGpio->Config(dev.pdata->sda_gpio, GPIO_INPUT);
+		gpio_clk_status = (gGpio->BankRead(scl_bank) & scl) != 0;
+		gGpio->BankDirection(sda_bank, sda, 0);
 		NanoSecondDelay(5);
 	}
 	
@@ -343,24 +518,64 @@ static int msm_i2c_recover_bus_busy(void)
 	return ERR_NOT_READY;
 }
 
-int msm_i2c_xfer(struct i2c_msg msgs[], int num)
+/* Bus clock for a target, hz overrides the per device setting if set */
+static int msm_i2c_xfer_hz(uint16_t addr, int hz)
 {
-	int ret, ret_wait;
+	UINTN i;
 
-	gClock->ClkEnable(dev.pdata->clk_nr);
+	if (hz)
+		return hz;
+
+	for (i = 0; i < ARRAY_SIZE(i2c_dev_speed); i++) {
+		if (i2c_dev_speed[i].hz && i2c_dev_speed[i].addr == addr)
+			return i2c_dev_speed[i].hz;
+	}
+
+	return dev.pdata->i2c_clock;
+}
+
+/*
+ * Powers the controller, makes sure the bus is idle and queues the first
+ * byte, the ISR moves the rest and sets dev.done.
+ */
+static int msm_i2c_start_xfer(struct i2c_msg msgs[], int num, int hz)
+{
+	int ret, i;
+	UINT64 bits = 0;
+	EFI_TPL OldTpl;
+
+	mXferStart = GetPerformanceCounter();
+	dev.err_status = 0;
+	dev.err_pos = 0;
+
+	msm_i2c_clk_get();
 	gInterrupt->EnableInterruptSource(gInterrupt, dev.pdata->irq_nr);
 
 	ret = msm_i2c_poll_notbusy(1);
 
 	if (ret) {
 		ret = msm_i2c_recover_bus_busy();
-		if (ret)
-			goto err;
+		if (ret) {
+			gInterrupt->DisableInterruptSource(gInterrupt, dev.pdata->irq_nr);
+			msm_i2c_clk_put();
+			mStats.Errors++;
+			return ret;
+		}
 	}
 
+	// Bus is idle, safe to retime it
+	hz = msm_i2c_set_clock(msm_i2c_xfer_hz(msgs->addr, hz));
+
+	for (i = 0; i < num; i++)
+		bits += (msgs[i].len + 1) * 9;
+	mXferTimeoutNs = DivU64x32(MultU64x32(bits * 2, 1000000000), hz) + I2C_XFER_SLACK_NS;
+
 	if (dev.flush_cnt) {
 		I2C_DBG(DEBUGLEVEL, "%d unrequested bytes read\n", dev.flush_cnt);
 	}
+
+	// The first byte must not race the ISR
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
 	dev.msg = msgs;
 	dev.rem = num;
 	dev.pos = -1;
@@ -368,12 +583,71 @@ int msm_i2c_xfer(struct i2c_msg msgs[], int num)
 	dev.need_flush = false;
 	dev.flush_cnt = 0;
 	dev.cnt = msgs->len;
+	dev.done = false;
+	timeout = 0;
 	msm_i2c_interrupt_locked();
+	gBS->RestoreTPL(OldTpl);
+
+	return 0;
+}
+
+static BOOLEAN msm_i2c_xfer_expired(void)
+{
+	return GetTimeInNanoSecond(GetPerformanceCounter() - mXferStart) > mXferTimeoutNs;
+}
+
+/*
+ * Gives up on a transfer the ISR did not finish in time. Detaching the
+ * message list turns a late interrupt into a no-op.
+ */
+static void msm_i2c_abort_xfer(void)
+{
+	EFI_TPL OldTpl;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	if (!dev.done) {
+		I2C_ERR("transfer timed out, status %x\n", readl(dev.pdata->i2c_base + I2C_STATUS));
+		dev.msg = NULL;
+		dev.ret = ERR_TIMED_OUT;
+		dev.done = true;
+		timeout = ERR_TIMED_OUT;
+	}
+	gBS->RestoreTPL(OldTpl);
+}
+
+/*
+ * Sleeps until the ISR finished the transfer. A caller at TPL_HIGH_LEVEL
+ * never sees the interrupt, it runs the ISR itself.
+ */
+static void msm_i2c_wait_xfer(void)
+{
+	BOOLEAN InterruptsEnabled;
+
+	while (!dev.done) {
+		if (msm_i2c_xfer_expired()) {
+			msm_i2c_abort_xfer();
+			break;
+		}
+
+		// Checked with the IRQ masked, WFI still wakes up on it
+		InterruptsEnabled = SaveAndDisableInterrupts();
+		if (!InterruptsEnabled)
+			msm_i2c_interrupt_locked();
+		else if (!dev.done)
+			ArmCallWFI();
+		SetInterruptState(InterruptsEnabled);
+	}
+}
+
+/*
+ * Waits for the bus to go idle, recovers it if needed and powers the
+ * controller down again. Returns the number of messages or an error.
+ */
+static int msm_i2c_finish_xfer(void)
+{
+	int ret, ret_wait;
+	UINT64 elapsed;
 
-	/*
-	 * Now that we've setup the xfer, the ISR will transfer the data
-	 * and wake us up with dev.err set if there was an error
-	 */
 	ret_wait = msm_i2c_poll_notbusy(0); /* Read may not have stopped in time */
 
 	if (dev.flush_cnt) {
@@ -416,11 +690,378 @@ int msm_i2c_xfer(struct i2c_msg msgs[], int num)
 	} */
 err:
 	gInterrupt->DisableInterruptSource(gInterrupt, dev.pdata->irq_nr);
-	gClock->ClkDisable(dev.pdata->clk_nr);
+	msm_i2c_clk_put();
+
+	elapsed = GetTimeInNanoSecond(GetPerformanceCounter() - mXferStart);
+	mStats.Transfers++;
+	mStats.TotalTimeNs += elapsed;
+	if (elapsed > mStats.MaxTimeNs)
+		mStats.MaxTimeNs = elapsed;
+	if (ret < 0 || ret_wait)
+		mStats.Errors++;
 	
 	return ret;
 }
 
+/*
+ * Takes the controller for a blocking transfer. Queued requests finish
+ * from TPL_NOTIFY, only a caller at TPL_APPLICATION can sleep until they
+ * are done. Anyone above may have preempted the owner, it fails instead.
+ */
+static BOOLEAN msm_i2c_claim(void)
+{
+	EFI_TPL OldTpl;
+	BOOLEAN claimed = FALSE;
+	BOOLEAN InterruptsEnabled;
+
+	for (;;) {
+		OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+		if (!mBusy) {
+			mBusy = TRUE;
+			claimed = TRUE;
+		}
+		gBS->RestoreTPL(OldTpl);
+
+		if (claimed || OldTpl != TPL_APPLICATION)
+			return claimed;
+
+		InterruptsEnabled = SaveAndDisableInterrupts();
+		if (mBusy)
+			ArmCallWFI();
+		SetInterruptState(InterruptsEnabled);
+	}
+}
+
+static void msm_i2c_master_run(void);
+
+/* Hands the controller to the next queued request or frees it */
+static void msm_i2c_release(void)
+{
+	EFI_TPL OldTpl;
+	BOOLEAN next;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	next = mQueueCount != 0;
+	if (!next)
+		mBusy = FALSE;
+	gBS->RestoreTPL(OldTpl);
+
+	if (next)
+		msm_i2c_master_run();
+}
+
+int msm_i2c_xfer_speed(struct i2c_msg msgs[], int num, UINTN hz)
+{
+	int ret;
+
+	if (!msm_i2c_claim())
+		return ERR_NOT_READY;
+
+	ret = msm_i2c_start_xfer(msgs, num, hz);
+	if (ret == 0) {
+		/*
+		 * Now that we've setup the xfer, the ISR will transfer the data
+		 * and wake us up with dev.err set if there was an error
+		 */
+		msm_i2c_wait_xfer();
+		ret = msm_i2c_finish_xfer();
+	}
+
+	msm_i2c_release();
+	return ret;
+}
+
+int msm_i2c_xfer(struct i2c_msg msgs[], int num)
+{
+	return msm_i2c_xfer_speed(msgs, num, 0);
+}
+
+/*
+ * Sets the bus clock used for a target, 0 reverts it to the bus default.
+ * Returns the clock the divider actually gives or a negative error.
+ */
+int msm_i2c_set_speed(int chip, UINTN hz)
+{
+	UINTN i, slot = ARRAY_SIZE(i2c_dev_speed);
+
+	if (hz != 0 && hz < I2C_STANDARD_MODE_HZ / 2)
+		return ERR_INVALID_ARGS;
+
+	for (i = 0; i < ARRAY_SIZE(i2c_dev_speed); i++) {
+		if (i2c_dev_speed[i].hz && i2c_dev_speed[i].addr == chip) {
+			slot = i;
+			break;
+		}
+		if (!i2c_dev_speed[i].hz && slot == ARRAY_SIZE(i2c_dev_speed))
+			slot = i;
+	}
+
+	if (slot == ARRAY_SIZE(i2c_dev_speed))
+		return ERR_NO_MEMORY;
+
+	i2c_dev_speed[slot].addr = chip;
+	i2c_dev_speed[slot].hz = MIN(hz, I2C_FAST_MODE_HZ);
+
+	hz = msm_i2c_xfer_hz(chip, 0);
+	return I2C_SRC_CLK_HZ / (2 * (msm_i2c_fs_div(hz) + 3));
+}
+
+/* Maps the outcome of the last transfer to EFI_I2C_MASTER_PROTOCOL codes */
+static EFI_STATUS msm_i2c_xfer_status(int ret, int num)
+{
+	if (ret == num)
+		return EFI_SUCCESS;
+
+	if (dev.err_status & I2C_STATUS_PACKET_NACKED)
+		return (dev.err_pos <= 0) ? EFI_NO_RESPONSE : EFI_DEVICE_ERROR;
+
+	if (ret == ERR_TIMED_OUT && dev.err_status == 0)
+		return EFI_TIMEOUT;
+
+	return EFI_DEVICE_ERROR;
+}
+
+/* Reports the head request through its event and moves on to the next */
+static void msm_i2c_master_complete(int ret)
+{
+	I2C_MASTER_REQUEST *req = mCurrent;
+	EFI_EVENT Event;
+	EFI_STATUS Status;
+	EFI_TPL OldTpl;
+
+	gBS->SetTimer(mXferTimeoutEvent, TimerCancel, 0);
+
+	Status = msm_i2c_xfer_status(ret, req->Count);
+	if (req->I2cStatus != NULL)
+		*req->I2cStatus = Status;
+	Event = req->Event;
+
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	mCurrent = NULL;
+	mQueueHead = (mQueueHead + 1) % I2C_MASTER_MAX_QUEUED;
+	mQueueCount--;
+	gBS->RestoreTPL(OldTpl);
+
+	gBS->SignalEvent(Event);
+	msm_i2c_release();
+}
+
+/* Starts the head request, the caller passes the controller on to it */
+static void msm_i2c_master_run(void)
+{
+	I2C_MASTER_REQUEST *req = &mQueue[mQueueHead];
+	EFI_TPL OldTpl;
+	int ret;
+
+	// Neither a done signal nor the timer left from the last transfer
+	// may match this one
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	dev.done = false;
+	mXferStart = GetPerformanceCounter();
+	mCurrent = req;
+	gBS->RestoreTPL(OldTpl);
+
+	ret = msm_i2c_start_xfer(req->Msgs, req->Count, req->Hz);
+	if (ret) {
+		msm_i2c_master_complete(ret);
+		return;
+	}
+
+	gBS->SetTimer(mXferTimeoutEvent, TimerRelative, DivU64x32(mXferTimeoutNs, 100) + 1);
+}
+
+STATIC
+VOID
+EFIAPI
+I2cXferDoneNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+	EFI_TPL OldTpl;
+	BOOLEAN done;
+
+	// Blocking callers finish their transfers themselves
+	OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+	done = mCurrent != NULL && dev.done;
+	gBS->RestoreTPL(OldTpl);
+
+	if (done)
+		msm_i2c_master_complete(msm_i2c_finish_xfer());
+}
+
+STATIC
+VOID
+EFIAPI
+I2cXferTimeoutNotify (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+	// The timer may be left over from an earlier request
+	if (mCurrent == NULL || !msm_i2c_xfer_expired())
+		return;
+
+	msm_i2c_abort_xfer();
+	msm_i2c_master_complete(msm_i2c_finish_xfer());
+}
+
+/* Translates a request packet, it was validated before */
+static void msm_i2c_master_msgs(struct i2c_msg *msgs, UINTN SlaveAddress, EFI_I2C_REQUEST_PACKET *RequestPacket)
+{
+	UINTN Index;
+
+	for (Index = 0; Index < RequestPacket->OperationCount; Index++) {
+		msgs[Index].addr  = SlaveAddress;
+		msgs[Index].flags = (RequestPacket->Operation[Index].Flags & I2C_FLAG_READ) ? I2C_M_RD : 0;
+		msgs[Index].len   = RequestPacket->Operation[Index].LengthInBytes;
+		msgs[Index].buf   = RequestPacket->Operation[Index].Buffer;
+	}
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+I2cMasterSetBusFrequency (
+  IN CONST EFI_I2C_MASTER_PROTOCOL  *This,
+  IN OUT UINTN                      *BusClockHertz
+  )
+{
+	if (BusClockHertz == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	if (*BusClockHertz < I2C_STANDARD_MODE_HZ / 2)
+		return EFI_UNSUPPORTED;
+
+	if (!msm_i2c_claim())
+		return EFI_ALREADY_STARTED;
+
+	// Never faster than asked for, fast mode at most. The divider is
+	// programmed when the next request starts.
+	mMasterHz = MIN(*BusClockHertz, I2C_FAST_MODE_HZ);
+	*BusClockHertz = I2C_SRC_CLK_HZ / (2 * (msm_i2c_fs_div(mMasterHz) + 3));
+	msm_i2c_release();
+
+	return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+I2cMasterReset (
+  IN CONST EFI_I2C_MASTER_PROTOCOL  *This
+  )
+{
+	int ret;
+
+	if (!msm_i2c_claim())
+		return EFI_ALREADY_STARTED;
+
+	msm_i2c_clk_get();
+	ret = msm_i2c_recover_bus_busy();
+	msm_i2c_clk_put();
+	msm_i2c_release();
+
+	return ret ? EFI_DEVICE_ERROR : EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EFIAPI
+I2cMasterStartRequest (
+  IN CONST EFI_I2C_MASTER_PROTOCOL  *This,
+  IN UINTN                          SlaveAddress,
+  IN EFI_I2C_REQUEST_PACKET         *RequestPacket,
+  IN EFI_EVENT                      Event      OPTIONAL,
+  OUT EFI_STATUS                    *I2cStatus OPTIONAL
+  )
+{
+	struct i2c_msg msgs[I2C_MASTER_MAX_OPERATIONS];
+	I2C_MASTER_REQUEST *req;
+	EFI_STATUS Status;
+	EFI_TPL OldTpl;
+	BOOLEAN start;
+	UINTN Index;
+	int ret;
+
+	if (RequestPacket == NULL || RequestPacket->OperationCount == 0)
+		return EFI_INVALID_PARAMETER;
+
+	// 7 bit addressing only, SMBus sequences are not done in hardware
+	if (SlaveAddress & I2C_ADDRESSING_10_BIT)
+		return EFI_UNSUPPORTED;
+	if (SlaveAddress > 0x7f)
+		return EFI_NOT_FOUND;
+
+	if (RequestPacket->OperationCount > I2C_MASTER_MAX_OPERATIONS)
+		return EFI_UNSUPPORTED;
+
+	for (Index = 0; Index < RequestPacket->OperationCount; Index++) {
+		EFI_I2C_OPERATION *Op = &RequestPacket->Operation[Index];
+
+		if (Op->Flags & ~I2C_FLAG_READ)
+			return EFI_UNSUPPORTED;
+		if (Op->LengthInBytes > 0xffff)
+			return EFI_BAD_BUFFER_SIZE;
+		if (Op->LengthInBytes != 0 && Op->Buffer == NULL)
+			return EFI_INVALID_PARAMETER;
+	}
+
+	// Queued, the outcome is reported through I2cStatus once Event fires
+	if (Event != NULL) {
+		OldTpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+		if (mQueueCount == I2C_MASTER_MAX_QUEUED) {
+			gBS->RestoreTPL(OldTpl);
+			return EFI_OUT_OF_RESOURCES;
+		}
+		req = &mQueue[(mQueueHead + mQueueCount) % I2C_MASTER_MAX_QUEUED];
+		msm_i2c_master_msgs(req->Msgs, SlaveAddress, RequestPacket);
+		req->Count = RequestPacket->OperationCount;
+		req->Hz = mMasterHz;
+		req->Event = Event;
+		req->I2cStatus = I2cStatus;
+		mQueueCount++;
+		start = !mBusy;
+		mBusy = TRUE;
+		gBS->RestoreTPL(OldTpl);
+
+		if (start)
+			msm_i2c_master_run();
+		return EFI_SUCCESS;
+	}
+
+	if (!msm_i2c_claim())
+		return EFI_ALREADY_STARTED;
+
+	msm_i2c_master_msgs(msgs, SlaveAddress, RequestPacket);
+	ret = msm_i2c_start_xfer(msgs, RequestPacket->OperationCount, mMasterHz);
+	if (ret == 0) {
+		msm_i2c_wait_xfer();
+		ret = msm_i2c_finish_xfer();
+	}
+	Status = msm_i2c_xfer_status(ret, RequestPacket->OperationCount);
+	msm_i2c_release();
+
+	if (I2cStatus != NULL)
+		*I2cStatus = Status;
+
+	return Status;
+}
+
+STATIC CONST EFI_I2C_CONTROLLER_CAPABILITIES mI2cCapabilities = {
+	sizeof(EFI_I2C_CONTROLLER_CAPABILITIES),
+	0xffff,
+	0xffff,
+	0xffff * I2C_MASTER_MAX_OPERATIONS
+};
+
+EFI_I2C_MASTER_PROTOCOL gI2cMaster = {
+	I2cMasterSetBusFrequency,
+	I2cMasterReset,
+	I2cMasterStartRequest,
+	&mI2cCapabilities
+};
+
 //struct mutex msm_i2c_rw_mutex;
 int msm_i2c_write(int chip, void *buf, UINTN count)
 {
@@ -473,6 +1114,42 @@ int msm_i2c_read(int chip, UINT8 reg, void *buf, UINTN count)
 	return rc;
 }
 
+/*
+ * SCL = source / (2 * (fs_div + 3)), pick the smallest divider that does
+ * not exceed the requested rate.
+ */
+static int msm_i2c_fs_div(int hz)
+{
+	int fs_div;
+
+	if (hz <= 0 || hz > I2C_FAST_MODE_HZ)
+		hz = hz <= 0 ? I2C_STANDARD_MODE_HZ : I2C_FAST_MODE_HZ;
+
+	fs_div = (I2C_SRC_CLK_HZ + 2 * hz - 1) / (2 * hz) - 3;
+	if (fs_div < 0)
+		fs_div = 0;
+	if (fs_div > I2C_CLK_CTL_FS_DIVIDER_VALUE)
+		fs_div = I2C_CLK_CTL_FS_DIVIDER_VALUE;
+
+	return fs_div;
+}
+
+/* Programs the bus clock divider, returns the resulting bus clock in Hz */
+static int msm_i2c_set_clock(int hz)
+{
+	int fs_div = msm_i2c_fs_div(hz);
+	int hs_div = 3;
+	int clk_ctl = ((hs_div & 0x7) << 8) | (fs_div & 0xff);
+
+	if (clk_ctl != mClkCtl) {
+		writel(clk_ctl, dev.pdata->i2c_base + I2C_CLK_CTL);
+		mClkCtl = clk_ctl;
+		I2C_DBG(DEBUGLEVEL, "msm_i2c_set_clock: clk_ctl %x, %d Hz\n", clk_ctl, I2C_SRC_CLK_HZ / (2 * (fs_div + 3)));
+	}
+
+	return I2C_SRC_CLK_HZ / (2 * (fs_div + 3));
+}
+
 int msm_i2c_probe(struct msm_i2c_pdata* pdata)
 {
 	if (dev.pdata) {
@@ -487,23 +1164,11 @@ int msm_i2c_probe(struct msm_i2c_pdata* pdata)
 	gInterrupt->DisableInterruptSource(gInterrupt, dev.pdata->irq_nr);
 	dev.pdata->set_mux_to_i2c(0);
 	gClock->ClkEnable(dev.pdata->clk_nr);
-	
-	int i2c_clk 	= 19200000;
-	int target_clk 	= 100000;
-	if (dev.pdata->i2c_clock) {
-		if (dev.pdata->i2c_clock < 100000 || dev.pdata->i2c_clock > 400000)
-			target_clk = 100000;
-		else
-			target_clk = dev.pdata->i2c_clock;
-	}
-	int fs_div = ((i2c_clk / target_clk) / 2) - 3;
-	int hs_div = 3;
-	int clk_ctl = ((hs_div & 0x7) << 8) | (fs_div & 0xff);
-	writel(clk_ctl, dev.pdata->i2c_base + I2C_CLK_CTL);
-	I2C_DBG(DEBUGLEVEL, "msm_i2c_probe: clk_ctl %x, %d Hz\n", clk_ctl, i2c_clk / (2 * ((clk_ctl & 0xff) + 3)));
-
+	msm_i2c_set_clock(dev.pdata->i2c_clock);
 	gClock->ClkDisable(dev.pdata->clk_nr);
 	gInterrupt->RegisterInterruptSource(gInterrupt, dev.pdata->irq_nr, I2CInterruptHandler);
+	// Moving the FIFO is slow with the write delays, let the tick preempt it
+	gIrqControl->SetNesting(dev.pdata->irq_nr, TRUE);
 
 	return 0;
 }
@@ -515,24 +1180,35 @@ void msm_i2c_remove() {
 	}
 
 	gInterrupt->DisableInterruptSource(gInterrupt, dev.pdata->irq_nr);
-	gClock->ClkDisable(dev.pdata->clk_nr);
+	gBS->SetTimer(mClkIdleEvent, TimerCancel, 0);
+	if (mClkOn) {
+		gClock->ClkDisable(dev.pdata->clk_nr);
+		mClkOn = FALSE;
+	}
 	dev.pdata->set_mux_to_i2c(0);
 	dev.pdata = NULL;
 }
 
+static const UINT32 i2c_mux_i2c[] = {
+	MSM_GPIO_CFG(GPIO_I2C_CLK, 0, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(GPIO_I2C_DAT, 0, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA),
+};
+
+static const UINT32 i2c_mux_gpio[] = {
+	MSM_GPIO_CFG(GPIO_I2C_CLK, 1, MSM_GPIO_CFG_INPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_2MA),
+	MSM_GPIO_CFG(GPIO_I2C_DAT, 1, MSM_GPIO_CFG_INPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_2MA),
+};
+
 void
 msm_set_i2c_mux(int mux_to_i2c) {
-	if (mux_to_i2c) {
-		pcom_gpio_tlmm_config(MSM_GPIO_CFG(GPIO_I2C_CLK, 0, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA), 0);
-		pcom_gpio_tlmm_config(MSM_GPIO_CFG(GPIO_I2C_DAT, 0, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA), 0);
-	} else {
-		pcom_gpio_tlmm_config(MSM_GPIO_CFG(GPIO_I2C_CLK, 1, MSM_GPIO_CFG_INPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_2MA), 0);
-		pcom_gpio_tlmm_config(MSM_GPIO_CFG(GPIO_I2C_DAT, 1, MSM_GPIO_CFG_INPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_2MA), 0);
-	}
+	if (mux_to_i2c)
+		gGpio->ConfigTable(i2c_mux_i2c, ARRAY_SIZE(i2c_mux_i2c), MSM_GPIO_CFG_ENABLE);
+	else
+		gGpio->ConfigTable(i2c_mux_gpio, ARRAY_SIZE(i2c_mux_gpio), MSM_GPIO_CFG_ENABLE);
 }
 
 static struct msm_i2c_pdata i2c_pdata = {
-	.i2c_clock = 400000,
+	.i2c_clock = I2C_STANDARD_MODE_HZ,
 	.clk_nr	= I2C_CLK,
 	.irq_nr = INT_PWB_I2C,
 	.scl_gpio = GPIO_I2C_CLK,
@@ -544,7 +1220,10 @@ static struct msm_i2c_pdata i2c_pdata = {
 HTCLEO_I2C_PROTOCOL gHtcLeoI2CProtocol = {
   msm_i2c_write,
   msm_i2c_read,
-  msm_i2c_xfer
+  msm_i2c_xfer,
+  msm_i2c_get_stats,
+  msm_i2c_set_speed,
+  msm_i2c_xfer_speed
 };
 
 EFI_STATUS
@@ -561,6 +1240,10 @@ I2CDxeInitialize(
   	Status = gBS->LocateProtocol (&gHardwareInterruptProtocolGuid, NULL, (VOID **)&gInterrupt);
   	ASSERT_EFI_ERROR (Status);
 
+	// Installed along with the interrupt controller protocol
+	Status = gBS->LocateProtocol (&gHtcLeoInterruptControlProtocolGuid, NULL, (VOID **)&gIrqControl);
+	ASSERT_EFI_ERROR (Status);
+
   	// Find the clock controller protocol.  ASSERT if not found.
   	Status = gBS->LocateProtocol (&gEmbeddedClockProtocolGuid, NULL, (VOID **)&gClock);
   	ASSERT_EFI_ERROR (Status);
@@ -569,11 +1252,24 @@ I2CDxeInitialize(
     Status = gBS->LocateProtocol (&gTlmmGpioProtocolGuid, NULL, (VOID **)&gGpio);
     ASSERT_EFI_ERROR (Status);
 
+	Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK, I2cClockIdleNotify, NULL, &mClkIdleEvent);
+	ASSERT_EFI_ERROR(Status);
+
+	Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_NOTIFY, I2cXferDoneNotify, NULL, &mXferDoneEvent);
+	ASSERT_EFI_ERROR(Status);
+
+	Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY, I2cXferTimeoutNotify, NULL, &mXferTimeoutEvent);
+	ASSERT_EFI_ERROR(Status);
+
+	Status = gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY, I2cExitBootServices, NULL, &mExitBootServicesEvent);
+	ASSERT_EFI_ERROR(Status);
+
   	msm_i2c_probe(&i2c_pdata);
 
-	// Install the i2c protocol onto a new handle
+	// Install the i2c protocols onto a new handle
 	Status = gBS->InstallMultipleProtocolInterfaces(
-	&Handle, &gHtcLeoI2CProtocolGuid, &gHtcLeoI2CProtocol, NULL);
+	&Handle, &gHtcLeoI2CProtocolGuid, &gHtcLeoI2CProtocol,
+	&gEfiI2cMasterProtocolGuid, &gI2cMaster, NULL);
 	ASSERT_EFI_ERROR(Status);
 
 	return Status;
@@ -39,6 +39,7 @@
 #include <Protocol/DevicePath.h>
 #include <Protocol/GpioTlmm.h>
 #include <Protocol/EmbeddedClock.h>
+#include <Protocol/HtcLeoCpuFreq.h>
 
 #include <Chipset/clock.h>
 
@@ -52,6 +53,9 @@ TLMM_GPIO *gGpio = NULL;
 // Cached copy of the Embedded Clock protocol instance
 EMBEDDED_CLOCK_PROTOCOL  *gClock = NULL;
 
+// Optional, transfers run at full speed when present
+HTCLEO_CPU_FREQ_PROTOCOL *gCpuFreq = NULL;
+
 EFI_BLOCK_IO_MEDIA gMMCHSMedia = 
 {
 	SIGNATURE_32('s', 'd', 'c', 'c'),         // MediaId
@@ -170,7 +174,11 @@ MMCHSReadBlocks(
 
     ReadSize = BufferSize / gMMCHSMedia.BlockSize;
 
+	if (gCpuFreq)
+		gCpuFreq->PinMax();
 	ret = sdc_dev->block_read(SDC_INSTANCE, (ulong)Lba, (lbaint_t)ReadSize, Buffer);
+	if (gCpuFreq)
+		gCpuFreq->UnpinMax();
 
 	if (ret)
     {
@@ -243,7 +251,11 @@ MMCHSWriteBlocks(
 
 	WriteSize = BufferSize / gMMCHSMedia.BlockSize;
 
+	if (gCpuFreq)
+		gCpuFreq->PinMax();
 	ret = sdc_dev->block_write(SDC_INSTANCE, (ulong)Lba, (lbaint_t)WriteSize, Buffer);
+	if (gCpuFreq)
+		gCpuFreq->UnpinMax();
 	
 	if (ret)
     {
@@ -305,6 +317,8 @@ SdCardInitialize(
   	Status = gBS->LocateProtocol (&gEmbeddedClockProtocolGuid, NULL, (VOID **)&gClock);
   	ASSERT_EFI_ERROR (Status);
 
+  	gBS->LocateProtocol (&gHtcLeoCpuFreqProtocolGuid, NULL, (VOID **)&gCpuFreq);
+
     if (!gGpio->Get(HTCLEO_GPIO_SD_STATUS))
     {
         // Enable the SDC2 clock
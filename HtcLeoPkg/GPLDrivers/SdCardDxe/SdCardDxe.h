@@ -14,12 +14,17 @@
 
 #include <Library/gpio.h>
 #include <Chipset/iomap.h>
+#include <Chipset/clock.h>
 #include <Library/reg.h>
 #include <Chipset/gpio.h>
 
+#include <Protocol/EmbeddedClock.h>
+
 #define BLOCK_SIZE 512
 #define SDC_INSTANCE 2
 
+extern EMBEDDED_CLOCK_PROTOCOL *gClock;
+
 // Function prototypes
 block_dev_desc_t *mmc_get_dev();
 
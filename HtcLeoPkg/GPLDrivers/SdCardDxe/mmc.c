@@ -62,14 +62,14 @@ enum SD_MCLK_speed
 	MCLK_50MHz = 50000000,
 };
 #else /*USE_PROC_COMM defined*/
+// In Hz, ClockDxe solves the M/N:D counters for these
 enum SD_MCLK_speed
 {
-//	MCLK_144KHz, //not implemented w/o proc_comm
-	MCLK_400KHz,
-	MCLK_25MHz,
-	MCLK_48MHz,
-//	MCLK_49MHz, //not implemented w/o proc_comm
-	MCLK_50MHz
+	MCLK_144KHz = 144000,
+	MCLK_400KHz = 400000,
+	MCLK_25MHz = 25000000,
+	MCLK_48MHz = 48000000,
+	MCLK_50MHz = 50000000,
 };
 #endif /*USE_PROC_COMM */
 
@@ -1412,9 +1412,9 @@ static int write_a_block_dm(uint32_t block_number, uint32_t num_blocks,
  */
 static int SD_MCLK_set(enum SD_MCLK_speed speed)
 {
+   // SDCn core clocks sit two ids apart, each followed by its pclk
+   uint32_t clk = SDC1_CLK + 2 * (sdcn.instance - 1);
 #ifndef USE_PROC_COMM
-   uint32_t md;
-   uint32_t ns;
    static int init_value_saved = FALSE;
 
    if (init_value_saved == FALSE)
@@ -1429,40 +1429,13 @@ static int SD_MCLK_set(enum SD_MCLK_speed speed)
     debug("BEFORE::SDC[%d]_NS_REG=0x%08x\n", sdcn.instance, IO_READ32(sdcn.ns_addr)) ;
     debug("BEFORE::SDC[%d]_MD_REG=0x%08x\n", sdcn.instance, IO_READ32(sdcn.md_addr)) ;
 
-#ifdef USE_PROC_COMM
-    //SDCn_NS_REG clk enable bits are turned on automatically as part of
-    //setting clk speed. No need to enable sdcard clk explicitely
-    pcom_set_sdcard_clk(sdcn.instance, speed);
-    debug("clkrate_hz=%lu\n",pcom_get_sdcard_clk(sdcn.instance));
-#else /*USE_PROC_COMM not defined */
-   switch (speed)
+   // ClockDxe programs MD/NS natively and keeps the NS enable bits
+   if (EFI_ERROR(gClock->ClkSetRate(clk, speed)))
    {
-   case MCLK_400KHz :
-       md = MCLK_MD_400KHZ;
-       ns = MCLK_NS_400KHZ;
-       break;
-   case MCLK_25MHz :
-       md = MCLK_MD_25MHZ;
-       ns = MCLK_NS_25MHZ;
-       break;
-   case MCLK_48MHz :
-       md = MCLK_MD_48MHZ;
-       ns = MCLK_NS_48MHZ;
-       break;
-   case MCLK_50MHz :
-       md = MCLK_MD_50MHZ;
-       ns = MCLK_NS_50MHZ;
-       break;
-   default:
        printf("Unsupported Speed\n");
        return FALSE;
-
    }
-
-   // Write to MCLK registers
-   IO_WRITE32(sdcn.md_addr, md);
-   IO_WRITE32(sdcn.ns_addr, ns);
-#endif /*USE_PROC_COMM*/
+   debug("clkrate_hz=%lu\n", gClock->ClkGetRate(clk));
 
    debug("AFTER::SDC[%d]_NS_REG=0x%08x\n", sdcn.instance, IO_READ32(sdcn.ns_addr)) ;
    debug("AFTER::SDC[%d]_MD_REG=0x%08x\n", sdcn.instance, IO_READ32(sdcn.md_addr)) ;
@@ -128,7 +128,7 @@
 #define GPIO_INT_STATUS_3  GPIO1_REG(0xF8)
 #define GPIO_INT_STATUS_4  GPIO1_REG(0xFC)
 #define GPIO_INT_STATUS_5  GPIO1_REG(0x100)
-#define GPIO_INT_STATUS_6  GPIO1_REG(0x103)
+#define GPIO_INT_STATUS_6  GPIO1_REG(0x104)
 #define GPIO_INT_STATUS_7  GPIO1_REG(0x108)
 
 enum {
@@ -187,6 +187,12 @@ enum gpio_irq_trigger {
 #define MSM_GPIO_PULL(gpio_cfg)   	(((gpio_cfg) >> 15) & 0x3)
 #define MSM_GPIO_DRVSTR(gpio_cfg) 	(((gpio_cfg) >> 17) & 0xf)
 
+/* TLMM pad config register layout, see GPIO1_PAGE / GPIO1_CFG */
+#define GPIO_CFG_PULL(x)          ((x) & 0x3)
+#define GPIO_CFG_FUNC(x)          (((x) & 0xf) << 2)
+#define GPIO_CFG_DRVSTR(x)        (((x) & 0x7) << 6)
+#define GPIO_CFG_MASK             0x1ff
+
 #define NR_MSM_GPIOS 164
 
 void msm_gpio_set_owner(unsigned gpio, unsigned owner);
@@ -65,6 +65,8 @@
 #define VIC_FIQ_IN_SERVICE  VIC_REG(0x00F0)
 #define VIC_FIQ_IN_STACK    VIC_REG(0x00F4)
 #define VIC_TEST_BUS_SEL    VIC_REG(0x00F8)
+#define VIC_VECTPRIORITY(n) VIC_REG(0x0200+((n) * 4))
+#define VIC_VECTADDR(n)     VIC_REG(0x0400+((n) * 4))
 
 #define SIRC_REG(off) (MSM_SIRC_BASE + (off))
 
@@ -78,5 +80,7 @@
 #define SIRC_IRQ0_STATUS    SIRC_REG(0x001C)
 #define SIRC_IRQ1_STATUS    SIRC_REG(0x0020)
 #define SIRC_RAW_STATUS     SIRC_REG(0x0024)
+#define SIRC_INT_CLEAR      SIRC_REG(0x0028)
+#define SIRC_SOFT_INT       SIRC_REG(0x002C)
 
 #endif
@@ -40,6 +40,9 @@ struct msm_i2c_dev {
 	int ret;
 	bool need_flush;
 	int flush_cnt;
+	bool done;		// ISR reached the end of the message list or gave up
+	uint32_t err_status;	// I2C_STATUS of the failing interrupt
+	int err_pos;		// message position it failed at, <= 0 = address
 };
 
 int msm_i2c_probe(struct msm_i2c_pdata*);
@@ -47,5 +50,7 @@ void msm_i2c_remove(void);
 int msm_i2c_write(int chip, void *buf, size_t count);
 int msm_i2c_read(int chip, uint8_t reg, void *buf, size_t count);
 int msm_i2c_xfer(struct i2c_msg msgs[], int num);
+int msm_i2c_xfer_speed(struct i2c_msg msgs[], int num, UINTN hz);
+int msm_i2c_set_speed(int chip, UINTN hz);
 
 #endif //__MSM_I2C_H__
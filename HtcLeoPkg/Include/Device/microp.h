@@ -93,6 +93,8 @@ struct microp_platform_data {
 int capella_cm3602_power(int pwr_device, UINT8 enable);
 int microp_i2c_read(UINT8 addr, UINT8 *data, int length);
 int microp_i2c_write(UINT8 addr, UINT8 *data, int length);
+void microp_batch_begin(void);
+int microp_batch_end(void);
 void microp_i2c_probe(struct microp_platform_data *kpdata);
 int microp_gpo_enable(UINT16 gpo_mask);
 int microp_gpo_disable(UINT16 gpo_mask);
@@ -40,6 +40,22 @@
 #define DS2745_CURRENT_ACCUM_RES	1562500
 #define DS2745_TEMPERATURE_RES		125
 
+// AUX0 through the current accumulator, fetched in one burst
+#define DS2746_BLOCK_START			DS2746_AUX0_MSB
+#define DS2746_BLOCK_SIZE			(DS2746_CURRENT_ACCUM_LSB - DS2746_BLOCK_START + 1)
+
+typedef struct {
+	UINT16 aux0;
+	UINT16 aux1;
+	UINT16 voltage;
+	INT16  current;
+	INT16  current_accum;
+} DS2746_REGS;
+
+INTN   ds2746_read_block(UINT8 addr, DS2746_REGS *regs);
+UINT32 ds2746_voltage_mv(CONST DS2746_REGS *regs);
+INT32  ds2746_current_ma(CONST DS2746_REGS *regs, UINT16 resistance);
+
 UINT32 ds2746_voltage(UINT8 addr);
 INT16  ds2746_current(UINT8 addr, UINT16 resistance);
 INT16  ds2745_temperature(UINT8 addr);
@@ -7,5 +7,7 @@ EFI_STATUS EFIAPI KeypadDeviceImplReset(KEYPAD_DEVICE_PROTOCOL *This);
 EFI_STATUS        KeypadDeviceImplGetKeys(
            KEYPAD_DEVICE_PROTOCOL *This, KEYPAD_RETURN_API *KeypadReturnApi,
            UINT64 Delta);
+EFI_STATUS EFIAPI KeypadDeviceImplArm(
+           KEYPAD_DEVICE_PROTOCOL *This, EFI_EVENT WakeEvent);
 
 #endif
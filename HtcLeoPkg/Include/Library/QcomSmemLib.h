@@ -9,4 +9,8 @@ SmemImplLibInitialize(VOID);
 
 extern QCOM_SMEM_PROTOCOL *gSMEM;
 
+/* Typed pointer to an SMEM item that holds at least a whole Type */
+#define SMEM_ITEM(Item, Type)                                                  \
+  ((Type *)gSMEM->smem_get_item((Item), sizeof(Type), NULL))
+
 #endif
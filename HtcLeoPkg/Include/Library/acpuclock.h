@@ -19,8 +19,25 @@ enum setrate_reason {
 	SETRATE_SWFI,
 };
 
+/* Transitions into one acpu_freq_tbl entry */
+struct acpuclk_step_stats {
+	unsigned switches;
+	unsigned hops;      /* slewed in place on the SCPLL */
+	unsigned failures;  /* SCPLL did not lock, left on the MPLL */
+	unsigned timed;     /* switches the DGT was running for */
+	unsigned last_ns;
+	unsigned max_ns;
+	unsigned long long total_ns;
+};
+
 void clock_config(UINT32 ns, UINT32 md, UINT32 ns_addr, UINT32 md_addr);
 int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason);
 unsigned long acpuclk_get_rate(void);
+/* kHz of acpu_freq_tbl entry step, ascending, 0 past the last one */
+unsigned acpuclk_step_khz(unsigned step);
+/* kHz floor voted for AXI/EBI1, 0 if the modem refused it */
+unsigned long acpuclk_get_axi_rate(void);
+/* 0 and a copy of the counters for acpu_freq_tbl entry step, -1 past the last one */
+int acpuclk_get_step_stats(unsigned step, struct acpuclk_step_stats *stats);
 void msm_acpu_clock_init(int freq_num);
 #endif //__QSD8K_PLATFORM_ACPUCLOCK_H_
\ No newline at end of file
@@ -375,10 +375,51 @@ enum
 	PCOM_NR_CLKS,
 };
 
+/* Time budget for the modem to become ready and to complete a command */
+#define PCOM_READY_TIMEOUT_US	500000
+#define PCOM_CMD_TIMEOUT_US		500000
+/* Times the modem interrupt is raised again before a command times out */
+#define PCOM_CMD_RETRIES		1
+/* Shared memory poll interval, doubled up to the max while waiting */
+#define PCOM_POLL_MIN_US		1
+#define PCOM_POLL_MAX_US		64
+
+struct pcom_stats {
+	unsigned calls;
+	unsigned failures;	/* modem answered PCOM_CMD_FAIL */
+	unsigned timeouts;
+	unsigned retries;
+	unsigned last_us;	/* latency of the last completed command */
+	unsigned max_us;
+	unsigned max_cmd;	/* command that took max_us */
+	UINT64 total_us;
+};
+
+/* One entry of a proc_comm batch, status and data carry the answer */
+struct pcom_cmd {
+	unsigned cmd;
+	unsigned data1;
+	unsigned data2;
+	int status;
+};
+
+#define PCOM_CMD(c, d1, d2)	{ .cmd = (c), .data1 = (d1), .data2 = (d2) }
+
+/* Commands per batch submission, longer batches are split */
+#define PCOM_BATCH_MAX			16
+
 void msm_pcom_init(void);
 
+/* All return 0 on success, -1 if the modem failed the command and
+ * ERR_TIMED_OUT if it didn't answer in time */
 int msm_pcom_wait_for_modem_ready(void);
 int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2);
+int msm_proc_comm_timeout(unsigned cmd, unsigned *data1, unsigned *data2,
+			  unsigned timeout_us, unsigned retries);
+void msm_pcom_get_stats(struct pcom_stats *stats);
+/* Runs independent commands back to back, each gets its own status.
+ * Returns the number of commands that did not succeed. */
+int msm_proc_comm_batch(struct pcom_cmd *cmds, unsigned count);
 
 int pcom_gpio_tlmm_config(unsigned config, unsigned disable);
 int pcom_vreg_set_level(unsigned id, unsigned mv);
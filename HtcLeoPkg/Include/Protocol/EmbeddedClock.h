@@ -14,12 +14,15 @@ typedef struct _EMBEDDED_CLOCK_PROTOCOL EMBEDDED_CLOCK_PROTOCOL;
 typedef EFI_STATUS(EFIAPI *CLOCK_ENABLE)(UINTN Id);
 typedef VOID(EFIAPI *CLOCK_DISABLE)(UINTN Id);
 typedef EFI_STATUS(EFIAPI *CLOCK_SET_RATE)(UINTN Id, UINTN Freq);
+// Hz, 0 if unknown. Cached until the next rate change.
+typedef UINTN(EFIAPI *CLOCK_GET_RATE)(UINTN Id);
 
 
 struct _EMBEDDED_CLOCK_PROTOCOL {
   CLOCK_ENABLE  ClkEnable;
   CLOCK_DISABLE ClkDisable;
   CLOCK_SET_RATE ClkSetRate;
+  CLOCK_GET_RATE ClkGetRate;
 };
 
 extern EFI_GUID gEmbeddedClockProtocolGuid;
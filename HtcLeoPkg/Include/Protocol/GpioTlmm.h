@@ -92,10 +92,138 @@ Arguments:
 
 --*/
 
+typedef
+EFI_STATUS
+(*TLMM_GPIO_PIN_TO_BANK)(
+  IN  TLMM_GPIO_PIN  Gpio,
+  OUT UINTN          *Bank,
+  OUT UINT32         *Mask
+  );
+
+/*++
+
+Routine Description:
+
+  Looks up the register bank holding a GPIO pin
+
+Arguments:
+
+  Gpio  - which pin
+  Bank  - bank index for the Bank* functions
+  Mask  - bit of the pin inside the bank registers
+
+Returns:
+
+  EFI_SUCCESS           - Bank and Mask are valid
+  EFI_INVALID_PARAMETER - no such pin
+
+--*/
+
+typedef
+UINT32
+(*TLMM_GPIO_BANK_READ)(
+  IN UINTN    Bank
+  );
+
+/*++
+
+Routine Description:
+
+  Reads the input level of every pin of a bank with a single access
+
+Arguments:
+
+  Bank  - bank index from PinToBank
+
+Returns:
+
+    Value - one bit per pin, 0 for an invalid bank
+
+--*/
+
+typedef
+VOID
+(*TLMM_GPIO_BANK_WRITE)(
+  IN UINTN    Bank,
+  IN UINT32   Mask,
+  IN UINT32   Value
+  );
+
+/*++
+
+Routine Description:
+
+  Updates the output latch of the pins selected by Mask, other pins of
+  the bank keep their value. Direction is not touched, see BankDirection.
+
+Arguments:
+
+  Bank  - bank index from PinToBank
+  Mask  - pins to update
+  Value - new output levels, only bits in Mask are used
+
+--*/
+
+typedef
+VOID
+(*TLMM_GPIO_BANK_DIRECTION)(
+  IN UINTN    Bank,
+  IN UINT32   Mask,
+  IN UINT32   OutputMask
+  );
+
+/*++
+
+Routine Description:
+
+  Sets the direction of the pins selected by Mask
+
+Arguments:
+
+  Bank        - bank index from PinToBank
+  Mask        - pins to update
+  OutputMask  - set bits become outputs, clear bits inputs
+
+--*/
+
+typedef
+EFI_STATUS
+(*TLMM_GPIO_CONFIG_TABLE)(
+  IN CONST UINT32   *Table,
+  IN UINTN          Count,
+  IN UINTN          Disable
+  );
+
+/*++
+
+Routine Description:
+
+  Applies a table of pad configurations (function, pull, drive strength
+  and direction). Pads of pins owned by the apps processor are written
+  straight to the TLMM, the rest is handed to the modem over proc_comm.
+
+Arguments:
+
+  Table   - MSM_GPIO_CFG() words
+  Count   - number of entries in Table
+  Disable - MSM_GPIO_CFG_ENABLE or MSM_GPIO_CFG_DISABLE
+
+Returns:
+
+  EFI_SUCCESS       - every entry was applied
+  EFI_DEVICE_ERROR  - the modem refused at least one entry
+
+--*/
+
 struct _TLMM_GPIO {
-  TLMM_GPIO_GET         Get;
-  TLMM_GPIO_SET         Set;
-  TLMM_GPIO_CONFIG      Config;
+  TLMM_GPIO_GET             Get;
+  TLMM_GPIO_SET             Set;
+  TLMM_GPIO_CONFIG          Config;
+  TLMM_GPIO_PIN_TO_BANK     PinToBank;
+  TLMM_GPIO_BANK_READ       BankRead;
+  TLMM_GPIO_BANK_WRITE      BankWrite;
+  TLMM_GPIO_BANK_DIRECTION  BankDirection;
+  TLMM_GPIO_CONFIG_TABLE    ConfigTable;
 };
 
 extern EFI_GUID  gTlmmGpioProtocolGuid;
@@ -0,0 +1,140 @@
+/** @file
+
+  Per pin interrupt dispatch for the QSD8250 TLMM GPIO block.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __TLMM_GPIO_INTERRUPT_H__
+#define __TLMM_GPIO_INTERRUPT_H__
+
+#include <Protocol/GpioTlmm.h>
+
+#define TLMM_GPIO_INTERRUPT_GUID                                               \
+  {                                                                            \
+    0x2c898318, 0x41c1, 0x4309,                                                \
+    {                                                                          \
+      0x89, 0x8a, 0x2f, 0x55, 0xc8, 0xcf, 0x0b, 0x89                           \
+    }                                                                          \
+  }
+
+//
+// Protocol interface structure
+//
+typedef struct _TLMM_GPIO_INTERRUPT TLMM_GPIO_INTERRUPT;
+
+//
+// Data Types
+//
+typedef enum {
+  GpioTriggerRising,
+  GpioTriggerFalling,
+  GpioTriggerBothEdges,
+  GpioTriggerLevelHigh,
+  GpioTriggerLevelLow,
+  GpioTriggerMax
+} TLMM_GPIO_TRIGGER;
+
+/*++
+
+Routine Description:
+
+  Called when a registered pin fires.
+
+  Without debouncing the handler runs from the GPIO summary interrupt at
+  TPL_HIGH_LEVEL and may only signal events. With a debounce window it
+  runs from a timer notification at TPL_NOTIFY once the pin was stable.
+
+  Level triggered pins are left masked after dispatch, the handler or
+  its deferred work calls Unmask once the source has been serviced.
+
+Arguments:
+
+  Gpio    - pin that fired
+  Level   - pin state sampled when the interrupt was dispatched
+  Context - value passed to Register
+
+--*/
+typedef
+VOID
+(EFIAPI *TLMM_GPIO_INTERRUPT_HANDLER)(
+  IN TLMM_GPIO_PIN  Gpio,
+  IN UINTN          Level,
+  IN VOID           *Context
+  );
+
+//
+// Function Prototypes
+//
+typedef
+EFI_STATUS
+(*TLMM_GPIO_INTERRUPT_REGISTER)(
+  IN TLMM_GPIO_PIN                Gpio,
+  IN TLMM_GPIO_TRIGGER            Trigger,
+  IN UINTN                        DebounceUs,
+  IN TLMM_GPIO_INTERRUPT_HANDLER  Handler,
+  IN VOID                         *Context
+  );
+
+/*++
+
+Routine Description:
+
+  Configures a pin as interrupt input and enables it
+
+Arguments:
+
+  Gpio        - which pin
+  Trigger     - edge or level condition
+  DebounceUs  - software debounce window, 0 to dispatch immediately
+  Handler     - callback
+  Context     - passed to Handler
+
+Returns:
+
+  EFI_SUCCESS           - pin armed
+  EFI_INVALID_PARAMETER - bad pin, trigger or handler
+  EFI_ALREADY_STARTED   - pin already has a handler
+
+--*/
+
+typedef
+EFI_STATUS
+(*TLMM_GPIO_INTERRUPT_UNREGISTER)(
+  IN TLMM_GPIO_PIN  Gpio
+  );
+
+/*++
+
+Routine Description:
+
+  Disables the pin interrupt and drops its handler
+
+--*/
+
+typedef
+EFI_STATUS
+(*TLMM_GPIO_INTERRUPT_MASK)(
+  IN TLMM_GPIO_PIN  Gpio
+  );
+
+/*++
+
+Routine Description:
+
+  Masks (Mask) or re-arms (Unmask) a registered pin. Unmask drops any
+  edge latched while the pin was masked.
+
+--*/
+
+struct _TLMM_GPIO_INTERRUPT {
+  TLMM_GPIO_INTERRUPT_REGISTER    Register;
+  TLMM_GPIO_INTERRUPT_UNREGISTER  Unregister;
+  TLMM_GPIO_INTERRUPT_MASK        Mask;
+  TLMM_GPIO_INTERRUPT_MASK        Unmask;
+};
+
+extern EFI_GUID  gTlmmGpioInterruptProtocolGuid;
+
+#endif
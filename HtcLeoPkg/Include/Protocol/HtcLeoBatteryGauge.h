@@ -0,0 +1,42 @@
+#ifndef __HTCLEO_PROTOCOL_BATTERY_GAUGE_H__
+#define __HTCLEO_PROTOCOL_BATTERY_GAUGE_H__
+
+#define HTCLEO_BATTERY_GAUGE_PROTOCOL_GUID                                     \
+  {                                                                            \
+    0x2c898318, 0x41c1, 0x4309,                                                \
+    {                                                                          \
+      0x89, 0x8a, 0x2f, 0x55, 0xc8, 0xcf, 0x0b, 0x8a                           \
+    }                                                                          \
+  }
+
+typedef struct _HTCLEO_BATTERY_GAUGE_PROTOCOL HTCLEO_BATTERY_GAUGE_PROTOCOL;
+
+typedef struct {
+  UINT64  TimestampNs;    // performance counter time the block was read
+  UINT32  VoltageMv;
+  INT32   CurrentMa;      // positive while charging
+  INT16   CurrentAccum;   // raw accumulated current register
+  UINT16  Aux0;           // raw battery id ratio
+  UINT16  Aux1;           // raw thermistor ratio
+  UINT8   SocRaw;         // percent, from this sample's voltage only
+  UINT8   Soc;            // percent, low pass filtered over samples
+} HTCLEO_BATTERY_SAMPLE;
+
+// Returns a sample no older than MaxAgeMs, 0 uses the PCD default age.
+// If the gauge can't be read it fails but still fills in the last good
+// sample, if there is one.
+typedef INTN(*gauge_get_sample_t)(HTCLEO_BATTERY_SAMPLE *Sample, UINTN MaxAgeMs);
+// Reads the gauge now regardless of the cache
+typedef INTN(*gauge_refresh_t)(HTCLEO_BATTERY_SAMPLE *Sample);
+// Restarts the filter from the next sample, e.g. after a cable change
+typedef VOID(*gauge_reset_filter_t)(VOID);
+
+struct _HTCLEO_BATTERY_GAUGE_PROTOCOL {
+  gauge_get_sample_t    GetSample;
+  gauge_refresh_t       Refresh;
+  gauge_reset_filter_t  ResetFilter;
+};
+
+extern EFI_GUID gHtcLeoBatteryGaugeProtocolGuid;
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __HTCLEO_PROTOCOL_CPU_FREQ_H__
+#define __HTCLEO_PROTOCOL_CPU_FREQ_H__
+
+#define HTCLEO_CPU_FREQ_PROTOCOL_GUID                                          \
+  {                                                                            \
+    0x2c898318, 0x41c1, 0x4309,                                                \
+    {                                                                          \
+      0x89, 0x8a, 0x2f, 0x55, 0xc8, 0xcf, 0x0b, 0x8c                           \
+    }                                                                          \
+  }
+
+typedef struct _HTCLEO_CPU_FREQ_PROTOCOL HTCLEO_CPU_FREQ_PROTOCOL;
+
+typedef struct {
+  UINT32  CurrentKhz;
+  UINT32  MinKhz;
+  UINT32  MaxKhz;
+  UINT32  AxiKhz;       // bus floor voted for the current step
+  UINT32  LoadPercent;  // busy share of the last judged window
+  UINT32  PinCount;
+  UINT64  Transitions;
+} HTCLEO_CPU_FREQ_STATE;
+
+// Transitions into one step, latency from the switch start until the
+// CPU runs from the new clock, not counting the bus vote
+typedef struct {
+  UINT32  Khz;
+  UINT32  Switches;
+  UINT32  Hops;         // slewed in place on the SCPLL, no relock
+  UINT32  Failures;     // SCPLL did not lock, fell back to the MPLL
+  UINT32  Timed;        // switches that have a latency sample
+  UINT32  LastNs;
+  UINT32  MaxNs;
+  UINT64  TotalNs;
+} HTCLEO_CPU_FREQ_STEP_STATS;
+
+// Holds the top step until the matching UnpinMax, calls nest. Called
+// at TPL_CALLBACK or above the switch follows once the TPL drops.
+typedef VOID(*cpufreq_pin_max_t)(VOID);
+typedef VOID(*cpufreq_unpin_max_t)(VOID);
+typedef VOID(*cpufreq_get_state_t)(HTCLEO_CPU_FREQ_STATE *State);
+// Steps count up from MinKhz, FALSE past the last one
+typedef BOOLEAN(*cpufreq_get_step_stats_t)(UINT32 Step, HTCLEO_CPU_FREQ_STEP_STATS *Stats);
+
+struct _HTCLEO_CPU_FREQ_PROTOCOL {
+  cpufreq_pin_max_t     PinMax;
+  cpufreq_unpin_max_t   UnpinMax;
+  cpufreq_get_state_t   GetState;
+  cpufreq_get_step_stats_t  GetStepStats;
+};
+
+extern EFI_GUID gHtcLeoCpuFreqProtocolGuid;
+
+#endif
@@ -13,14 +13,31 @@
 
 typedef struct _HTCLEO_I2C_PROTOCOL HTCLEO_I2C_PROTOCOL;
 
+// Transfer counters, times include powering the controller clock
+typedef struct {
+  UINT64  Transfers;
+  UINT64  Errors;
+  UINT64  TotalTimeNs;
+  UINT64  MaxTimeNs;
+  UINT64  ClockEnables;   // clock gate round trips to the modem
+} HTCLEO_I2C_STATS;
+
 typedef INTN(*i2c_write_t)(int chip, void *buf, UINTN count);
 typedef INTN(*i2c_read_t)(int chip, UINT8 reg, void *buf, UINTN count);
 typedef INTN(*i2c_xfer_t)(struct i2c_msg msgs[], int num);
+typedef VOID(*i2c_get_stats_t)(HTCLEO_I2C_STATS *Stats, BOOLEAN Reset);
+// Bus clock for a target (0 = bus default), returns the clock achieved
+typedef INTN(*i2c_set_speed_t)(int chip, UINTN hz);
+// Xfer at a given bus clock, hz == 0 uses the per target setting
+typedef INTN(*i2c_xfer_speed_t)(struct i2c_msg msgs[], int num, UINTN hz);
 
 struct _HTCLEO_I2C_PROTOCOL {
   i2c_write_t  Write;
   i2c_read_t Read;
   i2c_xfer_t Xfer;
+  i2c_get_stats_t GetStats;
+  i2c_set_speed_t SetSpeed;
+  i2c_xfer_speed_t XferSpeed;
 };
 
 extern EFI_GUID gHtcLeoI2CProtocolGuid;
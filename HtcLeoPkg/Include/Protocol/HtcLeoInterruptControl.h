@@ -0,0 +1,211 @@
+/** @file
+
+  QSD8250 VIC priority, nesting and per source interrupt statistics,
+  along with the delay statistics of all DXE modules.
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __HTCLEO_INTERRUPT_CONTROL_H__
+#define __HTCLEO_INTERRUPT_CONTROL_H__
+
+#define HTCLEO_INTERRUPT_CONTROL_PROTOCOL_GUID                                 \
+  {                                                                            \
+    0x2c898318, 0x41c1, 0x4309,                                                \
+    {                                                                          \
+      0x89, 0x8a, 0x2f, 0x55, 0xc8, 0xcf, 0x0b, 0x88                           \
+    }                                                                          \
+  }
+
+//
+// Protocol interface structure
+//
+typedef struct _HTCLEO_INTERRUPT_CONTROL_PROTOCOL HTCLEO_INTERRUPT_CONTROL_PROTOCOL;
+
+//
+// Data Types
+//
+#define VIC_PRIORITY_HIGHEST    0
+#define VIC_PRIORITY_LOWEST     7
+
+typedef struct {
+  UINT64  Count;          // Handler invocations
+  UINT64  TotalTimeNs;    // Time spent in the handler
+  UINT32  MaxTimeNs;      // Longest single handler run
+  UINT32  MaxLatencyNs;   // Longest assert to handler entry time
+  UINT64  TotalLatencyNs; // Sum of all latency samples
+  UINT64  LatencySamples; // Only sources with a timestamped trigger are sampled
+} HTCLEO_INTERRUPT_STATS;
+
+typedef struct {
+  UINT64  Calls;          // MicroSecondDelay/NanoSecondDelay invocations
+  UINT64  SleepCalls;     // Delays long enough to enter WFI
+  UINT64  TotalUs;        // Requested delay time
+  UINT64  SleptUs;        // Part of TotalUs spent in WFI
+  UINT32  MaxUs;          // Longest single delay
+  VOID    *MaxCaller;     // Return address of the longest delay
+} HTCLEO_DELAY_STATS;
+
+//
+// Function Prototypes
+//
+typedef
+EFI_STATUS
+(*HTCLEO_INTERRUPT_SET_PRIORITY)(
+  IN UINTN    Source,
+  IN UINTN    Priority
+  );
+
+/*++
+
+Routine Description:
+
+  Programs the VIC vector priority of a source. While a source is in
+  service the VIC only forwards sources with a numerically lower priority.
+
+Arguments:
+
+  Source    - VIC interrupt number
+  Priority  - VIC_PRIORITY_HIGHEST (0) to VIC_PRIORITY_LOWEST (7)
+
+Returns:
+
+  EFI_SUCCESS           - priority programmed
+  EFI_INVALID_PARAMETER - Source is not a VIC source or Priority is out of range
+
+--*/
+
+typedef
+EFI_STATUS
+(*HTCLEO_INTERRUPT_SET_NESTING)(
+  IN UINTN    Source,
+  IN BOOLEAN  Enable
+  );
+
+/*++
+
+Routine Description:
+
+  Allows higher priority sources to preempt the handler of Source. The
+  handler is then called at TPL_NOTIFY with the CPU IRQ unmasked, and
+  its vector is released as soon as it returns.
+
+Arguments:
+
+  Source  - VIC interrupt number, SIRC sources can't nest
+  Enable  - TRUE to run the handler preemptible
+
+--*/
+
+typedef
+EFI_STATUS
+(*HTCLEO_INTERRUPT_GET_STATS)(
+  IN  UINTN                   Source,
+  OUT HTCLEO_INTERRUPT_STATS  *Stats
+  );
+
+/*++
+
+Routine Description:
+
+  Returns the statistics collected for a source
+
+Arguments:
+
+  Source  - interrupt number, below NumberOfSources
+  Stats   - buffer receiving the counters
+
+--*/
+
+typedef
+VOID
+(*HTCLEO_INTERRUPT_RESET_STATS)(
+  VOID
+  );
+
+/*++
+
+Routine Description:
+
+  Clears the statistics of all sources and the delay statistics
+
+--*/
+
+typedef
+VOID
+(*HTCLEO_INTERRUPT_GET_IDLE_STATS)(
+  OUT UINT64  *IdleTicks,
+  OUT UINT64  *Ticks
+  );
+
+/*++
+
+Routine Description:
+
+  Returns how many timer ticks were taken and how many of them found
+  the CPU in WFI. Both only ever grow, ResetStats leaves them alone, so
+  callers compute their idle ratio from the difference of two calls.
+
+Arguments:
+
+  IdleTicks - ticks that interrupted WFI
+  Ticks     - all timer ticks
+
+--*/
+
+typedef
+VOID
+(*HTCLEO_INTERRUPT_RECORD_DELAY)(
+  IN UINTN    MicroSeconds,
+  IN UINT32   SleptUs,
+  IN VOID     *Caller
+  );
+
+/*++
+
+Routine Description:
+
+  Accounts a finished TimerLib delay. Called by the DXE GPTTimerLib
+  instance, may be called from interrupt handlers.
+
+Arguments:
+
+  MicroSeconds  - requested delay
+  SleptUs       - part of it spent in WFI
+  Caller        - return address of the delay call
+
+--*/
+
+typedef
+VOID
+(*HTCLEO_INTERRUPT_GET_DELAY_STATS)(
+  OUT HTCLEO_DELAY_STATS  *Stats
+  );
+
+/*++
+
+Routine Description:
+
+  Returns the delay statistics accumulated over all DXE modules
+
+Arguments:
+
+  Stats   - buffer receiving the counters
+
+--*/
+
+struct _HTCLEO_INTERRUPT_CONTROL_PROTOCOL {
+  UINTN                           NumberOfSources;
+  HTCLEO_INTERRUPT_SET_PRIORITY   SetPriority;
+  HTCLEO_INTERRUPT_SET_NESTING    SetNesting;
+  HTCLEO_INTERRUPT_GET_STATS      GetStats;
+  HTCLEO_INTERRUPT_RESET_STATS    ResetStats;
+  HTCLEO_INTERRUPT_GET_IDLE_STATS GetIdleStats;
+  HTCLEO_INTERRUPT_RECORD_DELAY   RecordDelay;
+  HTCLEO_INTERRUPT_GET_DELAY_STATS GetDelayStats;
+};
+
+extern EFI_GUID  gHtcLeoInterruptControlProtocolGuid;
+
+#endif
@@ -15,11 +15,24 @@ typedef struct _HTCLEO_MICROP_PROTOCOL HTCLEO_MICROP_PROTOCOL;
 typedef INTN(*microp_i2c_write_t)(UINT8 addr, UINT8 *cmd, INTN lengt);
 typedef INTN(*microp_i2c_read_t)(UINT8 addr, UINT8 *data, INTN length);
 typedef VOID(*microp_led_set_mode_t)(UINT8 mode);
+// Queue writes until the matching BatchEnd, which sends them in call order
+// as one I2C transaction
+typedef VOID(*microp_batch_begin_t)(VOID);
+typedef INTN(*microp_batch_end_t)(VOID);
+// GPI event callback, runs at TPL_CALLBACK with the IRQ_* bit that fired
+typedef VOID(*microp_irq_handler_t)(UINT16 status, VOID *context);
+// Claim and enable IRQ_* events, fails if one of them is taken already
+typedef INTN(*microp_irq_register_t)(UINT16 mask, microp_irq_handler_t handler, VOID *context);
+typedef INTN(*microp_irq_unregister_t)(UINT16 mask);
 
 struct _HTCLEO_MICROP_PROTOCOL {
   microp_i2c_write_t  Write;
   microp_i2c_read_t Read;
   microp_led_set_mode_t LedSetMode;
+  microp_batch_begin_t BatchBegin;
+  microp_batch_end_t BatchEnd;
+  microp_irq_register_t RegisterInterrupt;
+  microp_irq_unregister_t UnregisterInterrupt;
 };
 
 extern EFI_GUID gHtcLeoMicropProtocolGuid;
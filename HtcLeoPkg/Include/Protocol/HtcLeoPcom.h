@@ -0,0 +1,76 @@
+#ifndef __HTCLEO_PROTOCOL_PCOM_H__
+#define __HTCLEO_PROTOCOL_PCOM_H__
+
+#include <Library/pcom.h>
+
+#define HTCLEO_PCOM_PROTOCOL_GUID                                              \
+  {                                                                            \
+    0x2c898318, 0x41c1, 0x4309,                                                \
+    {                                                                          \
+      0x89, 0x8a, 0x2f, 0x55, 0xc8, 0xcf, 0x0b, 0x8b                           \
+    }                                                                          \
+  }
+
+typedef struct _HTCLEO_PCOM_PROTOCOL HTCLEO_PCOM_PROTOCOL;
+
+//
+// One proc_comm command. The caller owns the memory until the request
+// completed; Data1/Data2 carry the modem's answer afterwards.
+//
+typedef struct {
+  UINT32      Command;
+  UINT32      Data1;
+  UINT32      Data2;
+  UINTN       TimeoutUs;  // 0 uses PCOM_CMD_TIMEOUT_US
+  EFI_EVENT   Event;      // optional, signaled on completion
+  INTN        Status;     // 0, -1 modem failure or ERR_TIMED_OUT
+  BOOLEAN     Done;
+  // Private
+  LIST_ENTRY  Link;
+  UINT32      Start;
+  UINT32      Queued;
+  UINT32      IssuedAt;
+  UINT32      Arg1;
+  UINT32      Arg2;
+  UINTN       Retries;
+  BOOLEAN     Issued;
+} HTCLEO_PCOM_REQUEST;
+
+// Completed commands kept by the tracer
+#define PCOM_TRACE_ENTRIES  512
+
+typedef struct {
+  UINT32  Command;
+  UINT32  Data1;      // arguments as submitted
+  UINT32  Data2;
+  INT32   Status;     // 0, -1 modem failure or ERR_TIMED_OUT
+  UINT32  StartUs;    // performance counter time it was queued, wraps
+  UINT32  QueueUs;    // waiting behind other commands
+  UINT32  LatencyUs;  // issue to completion, retries included
+} HTCLEO_PCOM_TRACE_ENTRY;
+
+// Queues a request, completion is signaled through Request->Event
+typedef EFI_STATUS(*pcom_submit_t)(HTCLEO_PCOM_REQUEST *Request);
+// msm_proc_comm() semantics, callable at any TPL
+typedef INTN(*pcom_call_t)(UINT32 cmd, UINT32 *data1, UINT32 *data2);
+// msm_proc_comm_batch() semantics, the commands are queued back to back
+typedef INTN(*pcom_call_batch_t)(struct pcom_cmd *cmds, UINTN count);
+typedef VOID(*pcom_get_stats_t)(struct pcom_stats *stats);
+// Copies up to Count of the newest trace entries oldest first, returns
+// how many were copied; Total receives the number ever recorded
+typedef UINTN(*pcom_get_trace_t)(HTCLEO_PCOM_TRACE_ENTRY *Entries, UINTN Count, UINT64 *Total);
+// Clears the trace together with the GetStats counters
+typedef VOID(*pcom_reset_trace_t)(VOID);
+
+struct _HTCLEO_PCOM_PROTOCOL {
+  pcom_submit_t     Submit;
+  pcom_call_t       Call;
+  pcom_call_batch_t CallBatch;
+  pcom_get_stats_t  GetStats;
+  pcom_get_trace_t  GetTrace;
+  pcom_reset_trace_t ResetTrace;
+};
+
+extern EFI_GUID gHtcLeoPcomProtocolGuid;
+
+#endif
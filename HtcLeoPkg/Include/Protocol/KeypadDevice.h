@@ -26,9 +26,16 @@ typedef EFI_STATUS(EFIAPI *KEYPAD_GET_KEYS)(
     KEYPAD_DEVICE_PROTOCOL *This, KEYPAD_RETURN_API *KeypadReturnApi,
     UINT64 Delta);
 
+// Stop polling: once all keys are released the device arms its interrupts
+// and signals WakeEvent on the next key activity. Returns EFI_NOT_READY
+// while keys are still held and EFI_UNSUPPORTED for polled-only devices.
+typedef EFI_STATUS(EFIAPI *KEYPAD_ARM)(
+    KEYPAD_DEVICE_PROTOCOL *This, EFI_EVENT WakeEvent);
+
 struct _KEYPAD_DEVICE_PROTOCOL {
   KEYPAD_RESET    Reset;
   KEYPAD_GET_KEYS GetKeys;
+  KEYPAD_ARM      Arm;
 };
 
 extern EFI_GUID gEFIDroidKeypadDeviceProtocolGuid;
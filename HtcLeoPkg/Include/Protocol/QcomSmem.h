@@ -19,11 +19,19 @@ typedef void *(EFIAPI *smem_get_alloc_entry_t)(
     smem_mem_type_t type, uint32_t *size);
 typedef unsigned(EFIAPI *smem_read_alloc_entry_offset_t)(
     smem_mem_type_t type, void *buf, int len, int offset);
+/*
+ * Pointer into the uncached SMEM mapping, no copy and no cache
+ * maintenance needed. NULL unless the item is allocated and holds at
+ * least min_size bytes. size may be NULL.
+ */
+typedef void *(EFIAPI *smem_get_item_t)(
+    smem_mem_type_t type, uint32_t min_size, uint32_t *size);
 
 struct _QCOM_SMEM_PROTOCOL {
   smem_read_alloc_entry_t        smem_read_alloc_entry;
   smem_read_alloc_entry_offset_t smem_read_alloc_entry_offset;
   smem_get_alloc_entry_t         smem_get_alloc_entry;
+  smem_get_item_t                smem_get_item;
 };
 
 extern EFI_GUID gQcomSmemProtocolGuid;
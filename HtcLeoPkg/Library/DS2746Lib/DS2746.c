@@ -14,17 +14,57 @@
 // Cached copy of the i2c protocol
 HTCLEO_I2C_PROTOCOL *gI2C = NULL;
 
-uint32_t ds2746_voltage(uint8_t addr) {
-	uint32_t vol;
-	uint8_t s0, s1;
+/*
+ * The gauge auto increments the register pointer, so a MSB/LSB pair or
+ * the whole result block comes back from one repeated start read. The
+ * pairs are latched together, which avoids mixing halves of two samples.
+ */
+static int ds2746_read16(uint8_t addr, uint8_t reg, uint16_t *val)
+{
+	uint8_t s[2];
+
+	if (gI2C->Read(addr, reg, s, 2) < 0)
+		return -1;
+
+	*val = s[0] << 8 | s[1];
+	return 0;
+}
+
+int ds2746_read_block(uint8_t addr, DS2746_REGS *regs)
+{
+	uint8_t s[DS2746_BLOCK_SIZE];
+
+	if (gI2C->Read(addr, DS2746_BLOCK_START, s, sizeof(s)) < 0)
+		return -1;
 
-	gI2C->Read(addr, DS2746_VOLTAGE_MSB, &s0, 1);
-	gI2C->Read(addr, DS2746_VOLTAGE_LSB, &s1, 1);
+#define BLOCK16(reg) (s[(reg) - DS2746_BLOCK_START] << 8 | s[(reg) - DS2746_BLOCK_START + 1])
+	regs->aux0 = BLOCK16(DS2746_AUX0_MSB);
+	regs->aux1 = BLOCK16(DS2746_AUX1_MSB);
+	regs->voltage = BLOCK16(DS2746_VOLTAGE_MSB);
+	regs->current = (int16_t)BLOCK16(DS2746_CURRENT_MSB);
+	regs->current_accum = (int16_t)BLOCK16(DS2746_CURRENT_ACCUM_MSB);
+#undef BLOCK16
+
+	return 0;
+}
+
+uint32_t ds2746_voltage_mv(const DS2746_REGS *regs)
+{
+	return ((regs->voltage >> 4) * DS2746_VOLTAGE_RES) / 1000;
+}
+
+int32_t ds2746_current_ma(const DS2746_REGS *regs, uint16_t resistance)
+{
+	return ((regs->current >> 2) * DS2746_CURRENT_ACCUM_RES) / resistance;
+}
+
+uint32_t ds2746_voltage(uint8_t addr) {
+	DS2746_REGS regs;
 
-	vol = s0 << 8;
-	vol |= s1;
+	if (ds2746_read16(addr, DS2746_VOLTAGE_MSB, &regs.voltage) < 0)
+		return 0;
 
-	return ((vol >> 4) * DS2746_VOLTAGE_RES) / 1000;
+	return ds2746_voltage_mv(&regs);
 }
 
 /*
@@ -46,28 +86,22 @@ const uint16_t rsns[] = {
 };
 */
 int16_t ds2746_current(uint8_t addr, uint16_t resistance) {
-	int16_t cur;
-	int8_t s0, s1;
+	DS2746_REGS regs;
 
-	gI2C->Read(addr, DS2746_CURRENT_MSB, &s0, 1);
-	gI2C->Read(addr, DS2746_CURRENT_LSB, &s1, 1);
+	if (ds2746_read16(addr, DS2746_CURRENT_MSB, (uint16_t *)&regs.current) < 0)
+		return 0;
 
-	cur = s0 << 8;
-	cur |= s1;
-	
-	return (((cur >> 2) * DS2746_CURRENT_ACCUM_RES) / resistance);
+	return ds2746_current_ma(&regs, resistance);
 }
 
 int16_t ds2745_temperature(uint8_t addr) {
+	uint16_t raw;
 	int16_t temp;
-	int8_t s0, s1;
 
-	gI2C->Read(addr, DS2745_TEMPERATURE_MSB, &s0, 1);
-	gI2C->Read(addr, DS2745_TEMPERATURE_LSB, &s1, 1);
+	if (ds2746_read16(addr, DS2745_TEMPERATURE_MSB, &raw) < 0)
+		return 0;
 
-	temp = s0 << 8;
-	temp |= s1;
-	
+	temp = (int16_t)raw;
 	return ((temp >> 5) * DS2745_TEMPERATURE_RES);
 }
 
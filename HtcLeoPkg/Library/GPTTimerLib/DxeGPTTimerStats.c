@@ -0,0 +1,32 @@
+/*
+ * Delay accounting for DXE modules. Every delay is reported to
+ * InterruptDxe so the counters of all modules end up in one place.
+ * The protocol is looked up once when the module loads, delays can be
+ * made from interrupt handlers where boot services are off limits.
+ * Modules loaded before InterruptDxe are not accounted.
+ */
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <Protocol/HtcLeoInterruptControl.h>
+
+#include "GPTTimerLibInternal.h"
+
+STATIC HTCLEO_INTERRUPT_CONTROL_PROTOCOL *mIrqControl = NULL;
+
+RETURN_STATUS
+EFIAPI
+DxeGPTTimerLibConstructor (
+  VOID
+  )
+{
+	gBS->LocateProtocol(&gHtcLeoInterruptControlProtocolGuid, NULL, (VOID **)&mIrqControl);
+
+	return RETURN_SUCCESS;
+}
+
+VOID GptRecordDelay(UINTN MicroSeconds, UINT32 SleptUs, VOID *Caller)
+{
+	if (mIrqControl != NULL)
+		mIrqControl->RecordDelay(MicroSeconds, SleptUs, Caller);
+}
@@ -4,6 +4,12 @@
 #include <Library/PcdLib.h>
 #include <Library/DebugLib.h>
 #include <Library/BaseLib.h>
+#include <Library/ArmLib.h>
+
+#include <Chipset/interrupts.h>
+#include <Chipset/irqs.h>
+
+#include "GPTTimerLibInternal.h"
 
 #define GPT_REG(off)        (((UINTN)PcdGet32(PcdMsmGptBase)) + (off))
 
@@ -15,6 +21,15 @@
 #define GPT_ENABLE_CLR_ON_MATCH_EN        2
 #define GPT_ENABLE_EN                     1
 
+// GPT runs from the 32768 Hz sleep clock
+#define GPT_US_TO_TICKS(us)               (((UINT64)(us) * 33 + 1000 - 33) / 1000)
+#define GPT_TICKS_TO_US(ticks)            (((UINT64)(ticks) * 1000) / 33)
+
+// Wake up this many ticks early and spin the rest, WFI exit is not exact
+#define GPT_SLEEP_MARGIN_TICKS            2
+
+#define GPT_VIC_BIT                       (1 << INT_GP_TIMER_EXP)
+
 RETURN_STATUS
 EFIAPI
 TimerEarlyInit (
@@ -41,36 +56,109 @@ TimerConstructor (
   return RETURN_SUCCESS;
 }
 
-UINTN
-EFIAPI
-MicroSecondDelay (
-  IN      UINTN                     MicroSeconds
+STATIC
+BOOLEAN
+GptTicksElapsed (
+  IN UINT32 Start,
+  IN UINT32 Ticks
   )
 {
-  volatile UINTN Count;
-  UINT64 InitCount;
-  UINT64 Timeout;
-  UINT64 Ticks;
+  // Unsigned subtraction takes care of the counter wrapping
+  return (UINT32)(MmioRead32(GPT_COUNT_VAL) - Start) >= Ticks;
+}
+
+/**
+  Sleep in WFI until Ticks GPT ticks have passed since Start.
+
+  The GPT match interrupt is only used as a wake-up source, it is
+  consumed here with the CPU IRQ masked and never reaches InterruptDxe.
+  If the caller had interrupts enabled they are briefly opened after
+  every wake-up so the timer tick and other pending sources get served.
+  A handler run in that window may sleep itself and leave the match
+  register and the VIC bit behind, so both are armed on every pass.
+
+  @retval Number of ticks spent in here.
+
+**/
+STATIC
+UINT32
+GptSleepTicks (
+  IN UINT32 Start,
+  IN UINT32 Ticks
+  )
+{
+  BOOLEAN InterruptsEnabled;
+  UINT32  SleepStart;
+
+  InterruptsEnabled = SaveAndDisableInterrupts();
+  SleepStart = MmioRead32(GPT_COUNT_VAL);
+
+  MmioWrite32(VIC_INT_CLEAR0, GPT_VIC_BIT);
 
-  // calculate number of ticks we have to wait
-  Ticks = ((UINT64)MicroSeconds * 33 + 1000 - 33) / 1000;
+  while (!GptTicksElapsed(Start, Ticks)) {
+    MmioWrite32(GPT_MATCH_VAL, Start + Ticks);
+    MmioWrite32(VIC_INT_ENSET0, GPT_VIC_BIT);
+    ArmDataSynchronizationBarrier();
 
-  // get current counter value
-  Count = MmioRead32(GPT_COUNT_VAL);
-  InitCount = Count;
+    // The match may have passed while it was written, it would never fire
+    if (!GptTicksElapsed(Start, Ticks)) {
+      ArmCallWFI();
+    }
 
-  // Calculate timeout = cnt + ticks (mod 2^56)
-  // to account for timer counter wrapping
-  Timeout = (Count + Ticks) & (UINTN)(0xFFFFFFFF);
+    MmioWrite32(VIC_INT_CLEAR0, GPT_VIC_BIT);
+    ArmDataSynchronizationBarrier();
 
-  // Wait out till the counter wrapping occurs
-  // in cases where there is a wrapping.
-  while (Timeout < Count && InitCount <= Count)
-    Count = MmioRead32(GPT_COUNT_VAL);
+    if (InterruptsEnabled) {
+      EnableInterrupts();
+      DisableInterrupts();
+    }
+  }
+
+  MmioWrite32(VIC_INT_ENCLEAR0, GPT_VIC_BIT);
+  MmioWrite32(VIC_INT_CLEAR0, GPT_VIC_BIT);
+  ArmDataSynchronizationBarrier();
+
+  SetInterruptState(InterruptsEnabled);
+
+  return MmioRead32(GPT_COUNT_VAL) - SleepStart;
+}
+
+STATIC
+VOID
+GptDelay (
+  IN UINTN  MicroSeconds,
+  IN VOID   *Caller
+  )
+{
+  UINT32 Start;
+  UINT32 Ticks;
+  UINT32 Slept;
+
+  Start = MmioRead32(GPT_COUNT_VAL);
+  Ticks = (UINT32)GPT_US_TO_TICKS(MicroSeconds);
+  Slept = 0;
+
+  // The VIC is only live between InterruptDxe start and ExitBootServices,
+  // outside of that window nothing can wake us up from WFI.
+  if (MicroSeconds >= PcdGet32(PcdMsmGptSleepThresholdUs) &&
+      Ticks > GPT_SLEEP_MARGIN_TICKS &&
+      (MmioRead32(VIC_INT_MASTEREN) & 1) != 0) {
+    Slept = GptSleepTicks(Start, Ticks - GPT_SLEEP_MARGIN_TICKS);
+  }
 
-  // Wait till the number of ticks is reached
-  while (Timeout > Count)
-    Count = MmioRead32(GPT_COUNT_VAL);
+  // Spin out the remaining tail
+  while (!GptTicksElapsed(Start, Ticks));
+
+  GptRecordDelay(MicroSeconds, (UINT32)GPT_TICKS_TO_US(Slept), Caller);
+}
+
+UINTN
+EFIAPI
+MicroSecondDelay (
+  IN      UINTN                     MicroSeconds
+  )
+{
+  GptDelay(MicroSeconds, RETURN_ADDRESS(0));
 
   return MicroSeconds;
 }
@@ -87,7 +175,7 @@ NanoSecondDelay (
   MicroSeconds = NanoSeconds / 1000;
   MicroSeconds += ((NanoSeconds % 1000) == 0) ? 0 : 1;
 
-  MicroSecondDelay (MicroSeconds);
+  GptDelay(MicroSeconds, RETURN_ADDRESS(0));
 
   return NanoSeconds;
 }
@@ -0,0 +1,29 @@
+/** @file
+ *
+ *  GPT based TimerLib internals shared by the library instances.
+ *
+ *  This program and the accompanying materials
+ *  are licensed and made available under the terms and conditions of the BSD License
+ *  which accompanies this distribution.  The full text of the license may be found at
+ *  http://opensource.org/licenses/bsd-license.php
+ *
+ *  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+ *
+ **/
+
+#ifndef _GPT_TIMER_LIB_INTERNAL_H_
+#define _GPT_TIMER_LIB_INTERNAL_H_
+
+/**
+ * @brief Accounts a finished delay
+ *
+ * @param MicroSeconds  Requested delay
+ * @param SleptUs       Part of it spent in WFI
+ * @param Caller        Return address of the delay call
+ *
+ * @retval None
+ **/
+VOID GptRecordDelay(UINTN MicroSeconds, UINT32 SleptUs, VOID *Caller);
+
+#endif // _GPT_TIMER_LIB_INTERNAL_H_
@@ -0,0 +1,11 @@
+/*
+ * Delay accounting for modules that run before DXE, there is nothing
+ * to report the delays to.
+ */
+#include <Base.h>
+
+#include "GPTTimerLibInternal.h"
+
+VOID GptRecordDelay(UINTN MicroSeconds, UINT32 SleptUs, VOID *Caller)
+{
+}
@@ -142,6 +142,13 @@ ArmPlatformGetVirtualMemoryMap (
     VirtualMemoryTable[Index].Length          = FB_SIZE;
     VirtualMemoryTable[Index++].Attributes      = DDR_ATTRIBUTES_UNCACHED;
 
+    // Remap SMEM as uncached memory, it is handed out as plain pointers
+    // and the modem side does not snoop our caches
+    VirtualMemoryTable[Index].PhysicalBase  = FixedPcdGet64 (PcdMsmSharedBase);
+    VirtualMemoryTable[Index].VirtualBase     = VirtualMemoryTable[Index].PhysicalBase;
+    VirtualMemoryTable[Index].Length          = FixedPcdGet64 (PcdMsmSharedSize);
+    VirtualMemoryTable[Index++].Attributes      = DDR_ATTRIBUTES_UNCACHED;
+
     // Remap the FD region as normal executable memory
     VirtualMemoryTable[Index].PhysicalBase  = PcdGet64 (PcdFdBaseAddress);
     VirtualMemoryTable[Index].VirtualBase     = VirtualMemoryTable[Index].PhysicalBase;
@@ -8,11 +8,52 @@
 #include <Library/UefiLib.h>
 #include <Protocol/KeypadDevice.h>
 #include <Protocol/GpioTlmm.h>
+#include <Protocol/GpioTlmmInterrupt.h>
 
 #include <Device/Gpio.h>
 
 // Cached copy of the Hardware Gpio protocol instance
 TLMM_GPIO *gGpio = NULL;
+TLMM_GPIO_INTERRUPT *gGpioIrq = NULL;
+
+// Edges on the sense lines have to be stable this long to wake us up
+#define KEYPAD_WAKE_DEBOUNCE_US   5000
+// Settle time of the sense lines after the drive lines changed
+#define KEYPAD_SETTLE_US          5
+
+// Matrix drive lines and the pins that can report a key press while idle
+STATIC CONST UINT8 mKeypadDriveLines[] = {
+    HTCLEO_GPIO_KP_MKOUT0, HTCLEO_GPIO_KP_MKOUT1, HTCLEO_GPIO_KP_MKOUT2};
+STATIC CONST UINT8 mKeypadWakeLines[] = {
+    HTCLEO_GPIO_KP_MPIN0, HTCLEO_GPIO_KP_MPIN1, HTCLEO_GPIO_POWER_KEY};
+
+// Bank and bit of every line above, looked up once
+STATIC UINTN  mKeypadDriveBank;
+STATIC UINT32 mKeypadDriveMask;
+STATIC UINTN  mKeypadWakeBank[ARRAY_SIZE(mKeypadWakeLines)];
+STATIC UINT32 mKeypadWakeMask[ARRAY_SIZE(mKeypadWakeLines)];
+
+// One matrix row: its drive line and the keys (KeyList bits) sitting on it
+typedef struct {
+  UINT32 DriveMask;
+  UINT32 Keys;
+} KEYPAD_ROW;
+
+STATIC KEYPAD_ROW mKeypadRows[ARRAY_SIZE(mKeypadDriveLines)];
+STATIC UINTN      mKeypadSenseBank;
+STATIC UINT32     mKeypadLegacyKeys;
+STATIC UINT32     mKeypadLedKeys;
+
+// Debounced key state and the keys that read differently on the last scan,
+// one bit per KeyList entry. A key has to read the same on two consecutive
+// scans before its state flips.
+STATIC UINT32 mKeypadKeyState;
+STATIC UINT32 mKeypadKeyUnstable;
+
+STATIC BOOLEAN   mKeypadIrqAvailable = FALSE;
+STATIC BOOLEAN   mKeypadArmed        = FALSE;
+STATIC BOOLEAN   mKeypadWoken        = FALSE;
+STATIC EFI_EVENT mKeypadWakeEvent    = NULL;
 
 // Global variables
 EFI_EVENT m_CallbackTimer = NULL;
@@ -43,6 +84,10 @@ typedef struct {
 
   // pon
   BOOLEAN IsVolumeKey;
+
+  // bank and bit of Gpio (legacy) or GpioIn (keymatrix)
+  UINTN  Bank;
+  UINT32 Mask;
 } KEY_CONTEXT_PRIVATE;
 
 STATIC KEY_CONTEXT_PRIVATE KeyContextPower;
@@ -68,6 +113,8 @@ VOID KeypadInitializeKeyContextPrivate(KEY_CONTEXT_PRIVATE *Context)
   Context->DeviceType  = KEY_DEVICE_TYPE_UNKNOWN;
   Context->ActiveLow   = FALSE;
   Context->IsVolumeKey = FALSE;
+  Context->Bank        = 0;
+  Context->Mask        = 0;
 }
 
 STATIC
@@ -102,6 +149,174 @@ ExitBootServicesEvent (
   gGpio->Set(HTCLEO_GPIO_KP_LED, 0);
 }
 
+STATIC
+VOID KeypadInitLines(VOID)
+{
+  UINTN  Index;
+  UINTN  Bank;
+  UINT32 Mask;
+
+  // All drive lines share one bank, they are switched with a single write
+  mKeypadDriveMask = 0;
+  for (Index = 0; Index < ARRAY_SIZE(mKeypadDriveLines); Index++) {
+    gGpio->PinToBank(mKeypadDriveLines[Index], &Bank, &Mask);
+    ASSERT(Index == 0 || Bank == mKeypadDriveBank);
+    mKeypadDriveBank = Bank;
+    mKeypadDriveMask |= Mask;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE(mKeypadWakeLines); Index++)
+    gGpio->PinToBank(
+        mKeypadWakeLines[Index], &mKeypadWakeBank[Index],
+        &mKeypadWakeMask[Index]);
+}
+
+STATIC
+VOID KeypadInitMatrix(VOID)
+{
+  UINTN                Index;
+  UINTN                Row;
+  UINTN                Bank;
+  KEY_CONTEXT_PRIVATE *Context;
+
+  for (Row = 0; Row < ARRAY_SIZE(mKeypadDriveLines); Row++) {
+    gGpio->PinToBank(mKeypadDriveLines[Row], &Bank, &mKeypadRows[Row].DriveMask);
+    mKeypadRows[Row].Keys = 0;
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE(KeyList); Index++) {
+    Context = KeyList[Index];
+
+    if (Context->IsValid == FALSE)
+      continue;
+
+    if (!Context->IsVolumeKey)
+      mKeypadLedKeys |= 1U << Index;
+
+    if (Context->DeviceType == KEY_DEVICE_TYPE_LEGACY) {
+      gGpio->PinToBank(Context->Gpio, &Context->Bank, &Context->Mask);
+      mKeypadLegacyKeys |= 1U << Index;
+    } else if (Context->DeviceType == KEY_DEVICE_TYPE_KEYMATRIX) {
+      // Every sense line is sampled with the same bank read
+      gGpio->PinToBank(Context->GpioIn, &Context->Bank, &Context->Mask);
+      ASSERT(mKeypadSenseBank == 0 || Context->Bank == mKeypadSenseBank);
+      mKeypadSenseBank = Context->Bank;
+
+      for (Row = 0; Row < ARRAY_SIZE(mKeypadDriveLines); Row++) {
+        if (mKeypadDriveLines[Row] == Context->GpioOut)
+          mKeypadRows[Row].Keys |= 1U << Index;
+      }
+    }
+  }
+}
+
+STATIC
+VOID KeypadSetDriveLines(BOOLEAN High)
+{
+  gGpio->BankWrite(mKeypadDriveBank, mKeypadDriveMask, High ? mKeypadDriveMask : 0);
+  gGpio->BankDirection(mKeypadDriveBank, mKeypadDriveMask, mKeypadDriveMask);
+}
+
+// Returns the raw (undebounced) state of all keys, one bit per KeyList entry
+STATIC
+UINT32 KeypadScan(VOID)
+{
+  UINTN                Index;
+  UINTN                Row;
+  UINT32               Level;
+  UINT32               Keys;
+  UINT32               Raw = 0;
+  KEY_CONTEXT_PRIVATE *Context;
+
+  // Drive one row at a time and sample all of its sense lines at once
+  for (Row = 0; Row < ARRAY_SIZE(mKeypadRows); Row++) {
+    Keys = mKeypadRows[Row].Keys;
+    if (Keys == 0)
+      continue;
+
+    gGpio->BankWrite(mKeypadDriveBank, mKeypadRows[Row].DriveMask, 0);
+    Level = gGpio->BankRead(mKeypadSenseBank);
+    gGpio->BankWrite(
+        mKeypadDriveBank, mKeypadRows[Row].DriveMask,
+        mKeypadRows[Row].DriveMask);
+
+    for (Index = 0; Keys != 0; Index++, Keys >>= 1) {
+      Context = KeyList[Index];
+      if ((Keys & 1) && (((Level & Context->Mask) ? 1 : 0) ^ Context->ActiveLow))
+        Raw |= 1U << Index;
+    }
+  }
+
+  Keys = mKeypadLegacyKeys;
+  for (Index = 0; Keys != 0; Index++, Keys >>= 1) {
+    if ((Keys & 1) == 0)
+      continue;
+
+    Context = KeyList[Index];
+    Level   = gGpio->BankRead(Context->Bank);
+    if (((Level & Context->Mask) ? 1 : 0) ^ Context->ActiveLow)
+      Raw |= 1U << Index;
+  }
+
+  return Raw;
+}
+
+STATIC
+VOID KeypadDisarm(VOID)
+{
+  UINTN Index;
+
+  for (Index = 0; Index < ARRAY_SIZE(mKeypadWakeLines); Index++)
+    gGpioIrq->Mask(mKeypadWakeLines[Index]);
+
+  // Back to the scan idle state, every drive line released
+  KeypadSetDriveLines(TRUE);
+
+  mKeypadArmed = FALSE;
+}
+
+STATIC
+VOID
+EFIAPI
+KeypadWakeIrqHandler(IN TLMM_GPIO_PIN Gpio, IN UINTN Level, IN VOID *Context)
+{
+  if (!mKeypadArmed)
+    return;
+
+  KeypadDisarm();
+
+  // The edge was debounced already, trust the first scan
+  mKeypadWoken = TRUE;
+  gBS->SignalEvent(mKeypadWakeEvent);
+}
+
+STATIC
+VOID KeypadInitWakeLines(VOID)
+{
+  EFI_STATUS Status;
+  UINTN      Index;
+
+  Status = gBS->LocateProtocol(
+      &gTlmmGpioInterruptProtocolGuid, NULL, (VOID **)&gGpioIrq);
+  if (EFI_ERROR(Status))
+    return;
+
+  for (Index = 0; Index < ARRAY_SIZE(mKeypadWakeLines); Index++) {
+    Status = gGpioIrq->Register(
+        mKeypadWakeLines[Index], GpioTriggerFalling, KEYPAD_WAKE_DEBOUNCE_US,
+        KeypadWakeIrqHandler, NULL);
+    if (EFI_ERROR(Status)) {
+      DEBUG((EFI_D_ERROR, "Keypad: no IRQ on gpio %d, polling\n", mKeypadWakeLines[Index]));
+      while (Index-- > 0)
+        gGpioIrq->Unregister(mKeypadWakeLines[Index]);
+      return;
+    }
+    gGpioIrq->Mask(mKeypadWakeLines[Index]);
+  }
+
+  mKeypadIrqAvailable = TRUE;
+}
+
 RETURN_STATUS
 EFIAPI
 KeypadDeviceImplConstructor(VOID)
@@ -178,6 +393,13 @@ KeypadDeviceImplConstructor(VOID)
   StaticContext->ActiveLow  = 0x1 & 0x1;
   StaticContext->IsValid    = TRUE;
 
+  KeypadInitLines();
+  KeypadInitMatrix();
+  KeypadInitWakeLines();
+
+  // Scan idle state, every drive line released
+  KeypadSetDriveLines(TRUE);
+
   // Register for ExitBootServicesEvent
   Status = gBS->CreateEvent (
              EVT_SIGNAL_EXIT_BOOT_SERVICES,
@@ -253,9 +475,30 @@ EFI_STATUS KeypadDeviceImplGetKeys(
     KEYPAD_DEVICE_PROTOCOL *This, KEYPAD_RETURN_API *KeypadReturnApi,
     UINT64 Delta)
 {
-    UINT8 GpioStatus;
     BOOLEAN IsPressed;
     UINTN Index;
+    UINT32 Raw;
+    UINT32 Diff;
+    UINT32 Changed;
+
+    // Nothing can be pressed until the wake interrupt fires
+    if (mKeypadArmed)
+        return EFI_SUCCESS;
+
+    Raw = KeypadScan();
+
+    // A difference seen on two scans in a row (or right after a debounced
+    // wake up) flips the key, a single one is remembered as unstable
+    Diff    = Raw ^ mKeypadKeyState;
+    Changed = mKeypadWoken ? Diff : (Diff & mKeypadKeyUnstable);
+    mKeypadKeyUnstable = Diff & ~Changed;
+    mKeypadKeyState ^= Changed;
+    mKeypadWoken = FALSE;
+
+    // Light up on press and keep it lit for a while after the release
+    if (Changed & mKeypadLedKeys) {
+        EnableKeypadLedWithTimer();
+    }
 
     for (Index = 0; Index < (sizeof(KeyList) / sizeof(KeyList[0])); Index++) {
         KEY_CONTEXT_PRIVATE *Context = KeyList[Index];
@@ -264,30 +507,62 @@ EFI_STATUS KeypadDeviceImplGetKeys(
         if (Context->IsValid == FALSE)
             continue;
 
-        // get status
-        if (Context->DeviceType == KEY_DEVICE_TYPE_LEGACY) {
-            // implement hd2 gpio stuff here
-            GpioStatus = gGpio->Get(Context->Gpio);
-        } else if (Context->DeviceType == KEY_DEVICE_TYPE_KEYMATRIX) {
-            gGpio->Set(Context->GpioOut, 0);
-            GpioStatus = gGpio->Get(Context->GpioIn);
-        } else {
+        IsPressed = (mKeypadKeyState >> Index) & 1;
+
+        // Idle keys have nothing to report, only held keys and keys still
+        // going through their release need the repeat / longpress timing
+        if (!IsPressed && Context->EfiKeyContext.State == KEYSTATE_RELEASED)
             continue;
-        }
 
-        // update key status
-        IsPressed = (GpioStatus ? 1 : 0) ^ Context->ActiveLow;
+        LibKeyUpdateKeyStatus(
+            &Context->EfiKeyContext, KeypadReturnApi, IsPressed, Delta);
+    }
+
+    return EFI_SUCCESS;
+}
 
-        if (IsPressed && !Context->IsVolumeKey) {
-            EnableKeypadLedWithTimer();
-        }
+EFI_STATUS EFIAPI KeypadDeviceImplArm(
+    KEYPAD_DEVICE_PROTOCOL *This, EFI_EVENT WakeEvent)
+{
+    UINTN Index;
 
-        if (Context->DeviceType == KEY_DEVICE_TYPE_KEYMATRIX) {
-            gGpio->Set(Context->GpioOut, 1);
-        }
+    if (!mKeypadIrqAvailable)
+        return EFI_UNSUPPORTED;
 
-        LibKeyUpdateKeyStatus(
-            &Context->EfiKeyContext, KeypadReturnApi, IsPressed, Delta);
+    if (WakeEvent == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    if (mKeypadArmed)
+        return EFI_SUCCESS;
+
+    // Keep scanning until every key went through its release handling
+    if (mKeypadKeyState != 0 || mKeypadKeyUnstable != 0)
+        return EFI_NOT_READY;
+
+    for (Index = 0; Index < (sizeof(KeyList) / sizeof(KeyList[0])); Index++) {
+        KEY_CONTEXT_PRIVATE *Context = KeyList[Index];
+
+        if (Context->IsValid &&
+            Context->EfiKeyContext.State != KEYSTATE_RELEASED)
+            return EFI_NOT_READY;
+    }
+
+    // Assert all drive lines, any key now pulls its sense line low
+    KeypadSetDriveLines(FALSE);
+    MicroSecondDelay(KEYPAD_SETTLE_US);
+
+    mKeypadWakeEvent = WakeEvent;
+    mKeypadArmed = TRUE;
+
+    for (Index = 0; Index < ARRAY_SIZE(mKeypadWakeLines); Index++)
+        gGpioIrq->Unmask(mKeypadWakeLines[Index]);
+
+    // A key pressed before the unmask would not raise an edge
+    for (Index = 0; Index < ARRAY_SIZE(mKeypadWakeLines); Index++) {
+        if ((gGpio->BankRead(mKeypadWakeBank[Index]) & mKeypadWakeMask[Index]) == 0) {
+            KeypadDisarm();
+            return EFI_NOT_READY;
+        }
     }
 
     return EFI_SUCCESS;
@@ -27,88 +27,144 @@
 #define PCOM_MPP_FOR_USB_VBUS PM_MPP_16 //?
 #define PROC_COMM_END_CMDS 0xFFFF 
 
-void pcom_vreg_control(unsigned vreg, unsigned level, unsigned state)
+/* Modem calls that used to be retried forever give up after this many */
+#define PCOM_CLIENT_RETRIES 3
+
+/*
+ * Runs a recipe, then retries only the commands that failed. Answers
+ * overwrite data1/data2, so each retry starts from the original arguments.
+ */
+static int pcom_run_recipe(struct pcom_cmd *cmds, unsigned count)
 {
-    unsigned s = (state ? PCOM_ENABLE : PCOM_DISABLE);
-
-	/* If turning it ON, set the level first. */
-    if(state)
-    {
-		do
-        {
-            msm_proc_comm(PCOM_VREG_SET_LEVEL, &vreg, &level);
-		}while(PCOM_CMD_SUCCESS != readl(APP_STATUS));
-    }
-	
-	do
-    {
-        msm_proc_comm(PCOM_VREG_SWITCH, &vreg, &s);
-    }while(PCOM_CMD_SUCCESS != readl(APP_STATUS));
+	struct pcom_cmd args[PCOM_BATCH_MAX];
+	int retry, failed;
+	unsigned n;
+
+	ASSERT(count <= PCOM_BATCH_MAX);
+	memcpy(args, cmds, count * sizeof(*cmds));
+
+	failed = msm_proc_comm_batch(cmds, count);
+	for (retry = 1; failed && retry < PCOM_CLIENT_RETRIES; retry++) {
+		failed = 0;
+		for (n = 0; n < count; n++) {
+			if (cmds[n].status == 0)
+				continue;
+			memcpy(&cmds[n], &args[n], sizeof(*cmds));
+			failed += msm_proc_comm_batch(&cmds[n], 1);
+		}
+	}
+
+	return failed;
 }
 
-void pcom_sdcard_power(int state)
+/* TLMM configs of a pin table in as few batches as possible */
+static void pcom_gpio_recipe(const unsigned *cfg, unsigned count)
+{
+	struct pcom_cmd cmds[PCOM_BATCH_MAX];
+	unsigned n, queued = 0;
+
+	for (n = 0; n < count; n++) {
+		cmds[queued].cmd = PCOM_RPC_GPIO_TLMM_CONFIG_EX;
+		cmds[queued].data1 = cfg[n];
+		cmds[queued].data2 = MSM_GPIO_CFG_ENABLE;
+		if (++queued == PCOM_BATCH_MAX || n == count - 1) {
+			if (msm_proc_comm_batch(cmds, queued))
+				DEBUG((EFI_D_ERROR, "Error: GPIO recipe failed\n"));
+			queued = 0;
+		}
+	}
+}
+
+void pcom_vreg_control(unsigned vreg, unsigned level, unsigned state)
 {
-    unsigned v = PCOM_VREG_SDC;
 	unsigned s = (state ? PCOM_ENABLE : PCOM_DISABLE);
+	struct pcom_cmd level_cmd = PCOM_CMD(PCOM_VREG_SET_LEVEL, vreg, level);
+	struct pcom_cmd switch_cmd = PCOM_CMD(PCOM_VREG_SWITCH, vreg, s);
+
+	/*
+	 * If turning it ON, set the level first. The switch depends on it,
+	 * so it is a recipe of its own and only runs once the level took.
+	 */
+	if (state && pcom_run_recipe(&level_cmd, 1)) {
+		DEBUG((EFI_D_ERROR, "Error: PCOM_VREG_SET_LEVEL failed, vreg %u left off\n", vreg));
+		return;
+	}
 
-	while(1)
-	{
-		msm_proc_comm(PCOM_VREG_SWITCH, &v, &s);
+	if (pcom_run_recipe(&switch_cmd, 1))
+		DEBUG((EFI_D_ERROR, "Error: PCOM_VREG_SWITCH failed\n"));
+}
 
-        if(PCOM_CMD_SUCCESS != readl(APP_STATUS)) {
-			DEBUG((EFI_D_INFO, "Error: PCOM_VREG_SWITCH failed...retrying\n"));
-		} else {
-			DEBUG((EFI_D_INFO, "PCOM_VREG_SWITCH DONE\n"));
-			break;
-		}
-    }
+void pcom_sdcard_power(int state)
+{
+	struct pcom_cmd cmd = PCOM_CMD(PCOM_VREG_SWITCH, PCOM_VREG_SDC, state ? PCOM_ENABLE : PCOM_DISABLE);
+
+	if (pcom_run_recipe(&cmd, 1))
+		DEBUG((EFI_D_ERROR, "Error: PCOM_VREG_SWITCH failed\n"));
+	else
+		DEBUG((EFI_D_INFO, "PCOM_VREG_SWITCH DONE\n"));
 }
 
+//Note: GPIO_NO_PULL is for clock lines.
+/* Some cards had crc erorrs on multiblock reads.
+ * Increasing drive strength from 8 to 16 fixed that.
+ */
+static const unsigned sdc1_gpio_recipe[] = {
+	MSM_GPIO_CFG(51, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA),
+	MSM_GPIO_CFG(52, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA),
+	MSM_GPIO_CFG(53, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA),
+	MSM_GPIO_CFG(54, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA),
+	MSM_GPIO_CFG(55, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA),
+	MSM_GPIO_CFG(56, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_16MA),
+};
+
+static const unsigned sdc2_gpio_recipe[] = {
+	MSM_GPIO_CFG(62, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(63, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(64, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(65, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(66, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(67, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+};
+
+static const unsigned sdc3_gpio_recipe[] = {
+	MSM_GPIO_CFG(88, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(89, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(90, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(91, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(92, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(93, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(158, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(159, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(160, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(161, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+};
+
+static const unsigned sdc4_gpio_recipe[] = {
+	MSM_GPIO_CFG(142, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(143, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(144, 2, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(145, 2, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(146, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+	MSM_GPIO_CFG(147, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA),
+};
+
 void pcom_sdcard_gpio_config(int instance)
 {
-//Note: GPIO_NO_PULL is for clock lines.
 	switch (instance) {
 		case 1:
-			/* Some cards had crc erorrs on multiblock reads.
-			 * Increasing drive strength from 8 to 16 fixed that.
-			 */
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(51, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(52, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(53, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(54, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(55, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_16MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(56, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_16MA), MSM_GPIO_CFG_ENABLE);
+			pcom_gpio_recipe(sdc1_gpio_recipe, ARRAY_SIZE(sdc1_gpio_recipe));
 			break;
 
 		case 2:
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(62, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(63, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(64, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(65, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(66, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(67, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
+			pcom_gpio_recipe(sdc2_gpio_recipe, ARRAY_SIZE(sdc2_gpio_recipe));
 			break;
 
 		case 3:
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(88, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(89, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(90, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(91, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(92, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(93, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(158, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(159, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(160, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(161, 1, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
+			pcom_gpio_recipe(sdc3_gpio_recipe, ARRAY_SIZE(sdc3_gpio_recipe));
 			break;
 
 		case 4:
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(142, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_NO_PULL, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(143, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(144, 2, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(145, 2, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(146, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
-			pcom_gpio_tlmm_config(MSM_GPIO_CFG(147, 3, MSM_GPIO_CFG_OUTPUT, MSM_GPIO_CFG_PULL_UP, MSM_GPIO_CFG_8MA), MSM_GPIO_CFG_ENABLE);
+			pcom_gpio_recipe(sdc4_gpio_recipe, ARRAY_SIZE(sdc4_gpio_recipe));
 			break;
     }
 }
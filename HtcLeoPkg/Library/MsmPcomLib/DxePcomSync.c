@@ -0,0 +1,53 @@
+/*
+ * msm_proc_comm() for DXE modules, goes through the PCOM protocol once it
+ * is installed so all commands share its queue. Until then, or if the
+ * protocol can't be looked up at the caller's TPL, the modem is driven
+ * directly.
+ */
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/pcom.h>
+
+#include <Protocol/HtcLeoPcom.h>
+
+STATIC HTCLEO_PCOM_PROTOCOL *mPcom = NULL;
+
+STATIC HTCLEO_PCOM_PROTOCOL *pcom_protocol(void)
+{
+	EFI_TPL Tpl;
+
+	if (mPcom == NULL && gBS != NULL) {
+		Tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+		gBS->RestoreTPL(Tpl);
+		if (Tpl <= TPL_NOTIFY)
+			gBS->LocateProtocol(&gHtcLeoPcomProtocolGuid, NULL, (VOID **)&mPcom);
+	}
+
+	return mPcom;
+}
+
+int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
+{
+	if (pcom_protocol() != NULL)
+		return mPcom->Call(cmd, data1, data2);
+
+	return msm_proc_comm_timeout(cmd, data1, data2, PCOM_CMD_TIMEOUT_US, PCOM_CMD_RETRIES);
+}
+
+int msm_proc_comm_batch(struct pcom_cmd *cmds, unsigned count)
+{
+	unsigned n;
+	int failed = 0;
+
+	if (pcom_protocol() != NULL)
+		return mPcom->CallBatch(cmds, count);
+
+	for (n = 0; n < count; n++) {
+		cmds[n].status = msm_proc_comm_timeout(cmds[n].cmd, &cmds[n].data1, &cmds[n].data2,
+						       PCOM_CMD_TIMEOUT_US, PCOM_CMD_RETRIES);
+		if (cmds[n].status)
+			failed++;
+	}
+
+	return failed;
+}
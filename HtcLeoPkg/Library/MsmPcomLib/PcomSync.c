@@ -0,0 +1,24 @@
+/*
+ * msm_proc_comm() for modules that talk to the modem directly
+ */
+#include <Base.h>
+#include <Library/pcom.h>
+
+int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
+{
+	return msm_proc_comm_timeout(cmd, data1, data2, PCOM_CMD_TIMEOUT_US, PCOM_CMD_RETRIES);
+}
+
+int msm_proc_comm_batch(struct pcom_cmd *cmds, unsigned count)
+{
+	unsigned n;
+	int failed = 0;
+
+	for (n = 0; n < count; n++) {
+		cmds[n].status = msm_proc_comm(cmds[n].cmd, &cmds[n].data1, &cmds[n].data2);
+		if (cmds[n].status)
+			failed++;
+	}
+
+	return failed;
+}
@@ -29,6 +29,7 @@
  * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
+#include <Library/BaseLib.h>
 #include <Library/IoLib.h>
 #include <Library/ArmLib.h>
 #include <Library/DebugLib.h>
@@ -38,27 +39,52 @@
 
 #include <Chipset/clock.h>
 
-/* This function always returns 0, unless future versions check for
- * modem crash.
- * In that case it might return error.
+static struct pcom_stats pcom_stats;
+
+/* Set once a command timed out, later calls only probe the modem briefly */
+static int pcom_modem_hung;
+
+static UINT32 pcom_us_to_ticks(unsigned us)
+{
+	return (UINT32)DivU64x32(MultU64x32(GetPerformanceCounterProperties(NULL, NULL), us), 1000000);
+}
+
+static unsigned pcom_ticks_to_us(UINT32 ticks)
+{
+	return (unsigned)DivU64x32(GetTimeInNanoSecond(ticks), 1000);
+}
+
+/* Waits until addr reads value or timeout_us passed, polling the shared
+ * memory word with an exponentially growing delay.
+ * Returns 0 or ERR_TIMED_OUT.
  * This is called very early, dont debug here.
  */
-static int pcom_wait_for(UINT32 addr, UINT32 value)
+static int pcom_wait_for(UINT32 addr, UINT32 value, unsigned timeout_us)
 {
-	while (1) {
+	UINT32 start = (UINT32)GetPerformanceCounter();
+	UINT32 limit = pcom_us_to_ticks(timeout_us);
+	unsigned delay = PCOM_POLL_MIN_US;
 
-		if (readl(addr) == value){
+	while (1) {
+		if (readl(addr) == value)
 			return 0;
-		}
-		NanoSecondDelay(5);
+
+		if ((UINT32)GetPerformanceCounter() - start >= limit)
+			break;
+
+		MicroSecondDelay(delay);
+		if (delay < PCOM_POLL_MAX_US)
+			delay <<= 1;
 	}
+
+	// The modem may have answered while we checked the clock
+	return (readl(addr) == value) ? 0 : ERR_TIMED_OUT;
 }
 
 int msm_pcom_wait_for_modem_ready()
 {
 	// returns 0 to indicate success
-	// we return ~0 to indicate modem ready
-	return	~pcom_wait_for(MDM_STATUS,	PCOM_READY);
+	return pcom_wait_for(MDM_STATUS, PCOM_READY, PCOM_READY_TIMEOUT_US);
 }
 
 static inline void notify_modem(void)
@@ -68,12 +94,35 @@ static inline void notify_modem(void)
 	writel(1, MSM_A2M_INT(6));
 }
 
-int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
+int msm_proc_comm_timeout(unsigned cmd, unsigned *data1, unsigned *data2,
+			  unsigned timeout_us, unsigned retries)
 {
 	int ret = -1;
-	unsigned status;
+	unsigned status, elapsed;
+	UINT32 start;
+
+	start = (UINT32)GetPerformanceCounter();
+	pcom_stats.calls++;
+
+	/* A modem that stopped answering gets one short look instead of the
+	 * full budget on every call, it's back once it reports ready and
+	 * finished the command we gave up on. */
+	if (pcom_modem_hung) {
+		if (pcom_wait_for(MDM_STATUS, PCOM_READY, PCOM_POLL_MAX_US) ||
+		    (readl(APP_COMMAND) != PCOM_CMD_DONE && readl(APP_COMMAND) != PCOM_CMD_IDLE)) {
+			pcom_stats.timeouts++;
+			return ERR_TIMED_OUT;
+		}
+		DEBUG((EFI_D_ERROR, "[PCOM]: modem is responding again\n"));
+		pcom_modem_hung = 0;
+	}
 
-	msm_pcom_wait_for_modem_ready();
+	if (msm_pcom_wait_for_modem_ready()) {
+		DEBUG((EFI_D_ERROR, "[PCOM]: modem not ready [cmd:%x]\n", cmd));
+		pcom_stats.timeouts++;
+		pcom_modem_hung = 1;
+		return ERR_TIMED_OUT;
+	}
 	
 	writel(cmd, APP_COMMAND);
 	writel(data1 ? *data1 : 0, APP_DATA1);
@@ -81,7 +130,18 @@ int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
 	
 	notify_modem();
 	
-	pcom_wait_for(APP_COMMAND, PCOM_CMD_DONE);
+	while (pcom_wait_for(APP_COMMAND, PCOM_CMD_DONE, timeout_us)) {
+		if (retries-- == 0) {
+			DEBUG((EFI_D_ERROR, "[PCOM]: TIMEOUT [cmd:%x]\n", cmd));
+			pcom_stats.timeouts++;
+			pcom_modem_hung = 1;
+			/* APP_COMMAND is left alone, the modem still owns it */
+			return ERR_TIMED_OUT;
+		}
+		/* Only the interrupt is repeated, the command must not run twice */
+		pcom_stats.retries++;
+		notify_modem();
+	}
 	
 	status = readl(APP_STATUS);
 
@@ -91,14 +151,28 @@ int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
 		ret = 0;
 	} else {
 		DEBUG((EFI_D_INFO, "[PCOM]: FAIL [cmd:%x D1:%x D2:%x]\n", cmd, (unsigned)data1, (unsigned)data2));
+		pcom_stats.failures++;
 		ret = -1;
 	}
 
 	writel(PCOM_CMD_IDLE, APP_COMMAND);
 
+	elapsed = pcom_ticks_to_us((UINT32)GetPerformanceCounter() - start);
+	pcom_stats.last_us = elapsed;
+	pcom_stats.total_us += elapsed;
+	if (elapsed > pcom_stats.max_us) {
+		pcom_stats.max_us = elapsed;
+		pcom_stats.max_cmd = cmd;
+	}
+
 	return ret;
 }
 
+void msm_pcom_get_stats(struct pcom_stats *stats)
+{
+	*stats = pcom_stats;
+}
+
 void msm_pcom_init(void)
 {
 	writel(PCOM_CMD_IDLE, APP_COMMAND);